@@ -1,7 +1,7 @@
 /*
   PIN assign
   
-  (for LED bar)
+  (for LED bar, BAR_SPI_LENGTH = 0のとき)
   PB2
   PB3
   PB4
@@ -23,12 +23,38 @@
   PD2 G
   PB6 CATHODE1(10 Scale)
   PB7 CATHODE2(1 Scale)
+  (16MHz、20MHzの水晶のとき。BAR_SPI_LENGTHが必要。詳細はboard_profile.h)
+  PB6, PB7 水晶
+  PC1 CATHODE1(10 Scale)
+  PC2 CATHODE2(1 Scale)
   
   (for Switch)
   PC6 RESET(negative active)
   PB1 for Playing
   PB0 for Hi-Score Delete
   PD4 for Hi-Score display
+
+  (BAR_SPI_LENGTH != 0のとき。詳細はbar_spi.h)
+  PB2 74HC595 RCLK
+  PB3 74HC595 SER(MOSI)
+  PB5 74HC595 SRCLK(SCK)
+  PB4, PC0～PC5は未使用(水晶のときはPC1/PC2を7セグのカソードに使う)
+
+  (SOUNDを使うとき。詳細はsound.h, config.h)
+  PD3 スピーカ(SOUND_OC2B)。7セグのFはPC0(74HC595のバーのとき)かPB0へ
+  PB1 スピーカ(SOUND_OC1A)。ゲームスイッチはPC0(74HC595のバーのとき)かPB0へ
+  PB0を使うときは消去スイッチはなし
+
+  (UART_PIN_REMAP = 1のとき)
+  PD0 RXD
+  PD1 TXD
+  PD4 A
+  PB0 B
+  ハイスコア表示スイッチと消去スイッチはなし
+
+  (VERSUS = 1のとき。UART_PIN_REMAPが必要。詳細はversus.h)
+  PD0 RXD  相手のTXDへ
+  PD1 TXD  相手のRXDへ
   
  */
 
@@ -39,60 +65,52 @@
 #include <avr/interrupt.h>
 #include <util/delay.h>
 #include <avr/eeprom.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+#include "config.h"
+#include "containers.h"
+#include "power_profile.h"
+#include "clock_profile.h"
+#include "telemetry.h"
+#include "command.h"
+#include "trace.h"
+#include "bar_spi.h"
+#include "sound.h"
+#include "brightness.h"
+#include "bar_timer.h"
+#include "timer_wheel.h"
+#include "coroutine.h"
+#include "scan_engine.h"
+#include "probe.h"
+#include "warm_resume.h"
+#include "supply.h"
+#include "persistent.h"
+#include "power_fail.h"
+#include "versus.h"
+#include "self_test.h"
 
 constexpr int MAX_SCORE = 99;
 
-// 1秒に何回タイマ割り込みが起こるか
-constexpr int FRAME_PER_SEC = 500;
+// 1秒に何回タイマ割り込みが起こるか(実際はTIMER_HZ / TICK_COUNTS = 約488回、FAST_TICKでは約2016回)
+constexpr int FRAME_PER_SEC = FAST_TICK ? 2000 : 500;
 
 // タイマ割り込みのたびに1増えるカウンタ
 uint32_t global_timer = 0;
 
-// 配列。最低限の機能のみ
-template <class T, int N>
-struct array
-{
-	T elem[N];
+// ウォッチドッグのリセットから再開するための写し(warm_resume.h)。スタートアップで消さない
+uint8_t reset_cause __attribute__((section(".noinit")));
+warm_image warm_image_ram __attribute__((section(".noinit")));
+uint8_t warm_resume_count __attribute__((section(".noinit")));
 
-	T& operator [] (int i) {
-		return elem[i];
-	}
-	const T& operator [] (int i) const {
-		return elem[i];
-	}
+void save_reset_cause() __attribute__((naked, used, section(".init3")));
 
-	T* begin() {
-		return elem;
-	}
-	const T* begin() const {
-		return elem;
-	}
-	T* end() {
-		return elem + N;
-	}
-	const T* end() const {
-		return elem + N;
-	}
-};
-
-// 出力ピン。入出力方向は別途設定する必要がある。
-class output_pin
+void save_reset_cause()
 {
-public:
-	output_pin(volatile uint8_t* port, uint8_t bit) : m_port(port), m_bit(bit) {}
-
-	void set() {
-		*m_port = static_cast<uint8_t>(*m_port | _BV(m_bit));
-	}
-
-	void reset() {
-		*m_port = static_cast<uint8_t>(*m_port & ~_BV(m_bit));
-	}
-
-private:
-	volatile uint8_t* m_port;
-	uint8_t m_bit;
-};
+	reset_cause = MCUSR;
+	MCUSR = 0;
+	wdt_disable();
+}
 
 // 入力ピン
 class input_pin
@@ -109,6 +127,15 @@ private:
 	uint8_t m_bit;
 };
 
+// 接続されていないスイッチ。常に離した状態
+class no_input_pin
+{
+public:
+	bool read() {
+		return true;
+	}
+};
+
 namespace seven_segments_data
 {
 	static constexpr uint8_t A = 0x01;
@@ -134,76 +161,83 @@ namespace seven_segments_data
 	};
 }
 
-// 7セグ一桁分を表すクラス
+// 7セグとバーのLEDのスキャン。スコアの桁ごとに1スロットで、約8msごとに桁を切り替える
+constexpr int SCORE_DIGITS = 2;
+scan_engine<SCORE_DIGITS, FAST_TICK ? 16 : 4> led_scan;
+
+// 7セグ一桁分を表すクラス。led_scanのスロットの像に書く
 class seven_segments
 {
 public:
-	seven_segments(const array<output_pin, 7>& pin) : m_pin(pin) {}
+	seven_segments(const array<scan_pin, 7>& pin) : m_pin(pin) {}
 
-	void set_number(int n) {
-		if (n < 0 || n >= 10) return;
-		for (int i = 0; i < 7; ++i) {
-			if ((seven_segments_data::segment_data[n] & _BV(i)) != 0) {
-				m_pin[i].set();
-			} else {
-				m_pin[i].reset();
-			}
+	// スキャンの対象にする。消灯はLow
+	void claim() {
+		for (auto& p : m_pin) {
+			led_scan.claim(p, false);
 		}
 	}
 
-	void erase_number() {
-		for (auto& p : m_pin) {
-			p.reset();
+	// segment_dataと同じ並び(ビット0がA)で点灯するセグメントを指定する
+	void write(port_image& image, uint8_t pattern) const {
+		for (int i = 0; i < 7; ++i) {
+			m_pin[i].write(image, (pattern & _BV(i)) != 0);
 		}
 	}
 
 private:
-	array<output_pin, 7> m_pin;
+	array<scan_pin, 7> m_pin;
 };
 
-// ダイナミック点灯による複数桁表示。カソードコモン用
+// ダイナミック点灯による複数桁表示。カソードコモン用。桁の切り替えはled_scanが行う
 template <int Digit>
 class seven_segments_dynamic
 {
 	static_assert(Digit >= 1, "digit must be greater than 1.");
+	static_assert(Digit == decltype(led_scan)::SLOTS, "each digit needs its own scan slot.");
 public:
-	seven_segments_dynamic(const seven_segments& display, const array<output_pin, Digit> cathode)
+	seven_segments_dynamic(const seven_segments& display, const array<scan_pin, Digit> cathode)
 		: m_display(display), m_cathode(cathode) {}
 
+	// スロットiでは桁iのカソードだけLowにしておく
 	void init() {
-		for (auto& p : m_cathode) {
-			p.set();
+		m_display.claim();
+		for (uint8_t i = 0; i < Digit; ++i) {
+			led_scan.claim(m_cathode[i], true);
+			m_cathode[i].reset(led_scan.slot(i));
 		}
-		m_display.erase_number();
 	}
 
-	// 変更はchange_digitを呼ぶまで反映されない
+	// 毎ティック同じ値で呼ばれるので、値が変わったときだけ各桁のセグメントを書き直す
 	void set_number(uint32_t value) {
 		if (value >= pow10(Digit)) {
 			erase_number();
 			return;
 		}
+		if (m_valid && value == m_value) return;
 		m_valid = true;
 		m_value = value;
+		for (uint8_t i = 0; i < Digit; ++i) {
+			m_display.write(led_scan.slot(i), seven_segments_data::segment_data[value % 10]);
+			value /= 10;
+		}
 	}
 
-	void erase_number() {
-		m_valid = false;
-		m_display.erase_number();
+	// 全桁に同じセグメント(segment_dataと同じ並び)を点ける。自己診断のランプの点検用
+	void set_pattern(uint8_t pattern) {
+		m_valid = true;
+		m_value = pow10(Digit);    // set_numberには来ない値なので、次のset_numberで必ず書き直す
+		for (uint8_t i = 0; i < Digit; ++i) {
+			m_display.write(led_scan.slot(i), pattern);
+		}
 	}
 
-	void change_digit() {
-		m_cathode[m_now_digit].set();
-		++m_now_digit;
-		if (m_now_digit == Digit) {
-			m_now_digit = 0;
-		}
-		if (m_valid) {
-			// 現在の桁を計算し、7セグに表示
-			m_display.set_number(static_cast<int>(m_value / pow10(m_now_digit) % 10));
+	void erase_number() {
+		if (!m_valid) return;
+		m_valid = false;
+		for (uint8_t i = 0; i < Digit; ++i) {
+			m_display.write(led_scan.slot(i), 0);
 		}
-		// カソードコモンなので表示する桁をLowに
-		m_cathode[m_now_digit].reset();
 	}
 
 private:
@@ -212,56 +246,156 @@ private:
 	}
 
 	seven_segments m_display;
-	array<output_pin, Digit> m_cathode;
+	array<scan_pin, Digit> m_cathode;    // 0番が1の位
 	bool m_valid = false;
 	uint32_t m_value = 0;
-	int m_now_digit = 0;
 };
 
-seven_segments_dynamic<2> score_display
+// SOUNDの出力ピンと重なる機能の移し先。74HC595のバーならPC0、そうでなければ消去スイッチのPB0
+#if SOUND && BAR_SPI_LENGTH
+#define RELOCATED_OUTPUT {&PORTC, PC0}
+#define RELOCATED_INPUT {&PINC, PC0}
+constexpr uint8_t RELOCATED_B = 0;
+constexpr uint8_t RELOCATED_C = _BV(PC0);
+#elif SOUND
+#define RELOCATED_OUTPUT {&PORTB, PB0}
+#define RELOCATED_INPUT {&PINB, PB0}
+constexpr uint8_t RELOCATED_B = _BV(PB0);
+constexpr uint8_t RELOCATED_C = 0;
+#endif
+
+#define HAS_HIGH_SCORE_SWITCH (!UART_PIN_REMAP)
+#define HAS_ERASE_SWITCH (!UART_PIN_REMAP && !(SOUND && !BAR_SPI_LENGTH))
+
+#if UART_PIN_REMAP
+#define SEGMENT_A {&PORTD, PD4}
+#define SEGMENT_B {&PORTB, PB0}
+#else
+#define SEGMENT_A {&PORTD, PD1}
+#define SEGMENT_B {&PORTD, PD0}
+#endif
+#if SOUND == SOUND_OC2B
+#define SEGMENT_F RELOCATED_OUTPUT
+#else
+#define SEGMENT_F {&PORTD, PD3}
+#endif
+
+// 水晶のときはPB6/PB7が使えないので、74HC595のバーで空いたPC1/PC2に移す
+#if BOARD_CRYSTAL
+#define CATHODE_1 {&PORTC, PC2}
+#define CATHODE_10 {&PORTC, PC1}
+#else
+#define CATHODE_1 {&PORTB, PB7}
+#define CATHODE_10 {&PORTB, PB6}
+#endif
+
+seven_segments_dynamic<SCORE_DIGITS> score_display
 {
-	seven_segments{{{{&PORTD, PD1}, {&PORTD, PD0}, {&PORTD, PD7}, {&PORTD, PD6}, {&PORTD, PD5}, {&PORTD, PD3}, {&PORTD, PD2}}}},
-	{{{&PORTB, PB7}, {&PORTB, PB6}}}
+	seven_segments{{{SEGMENT_A, SEGMENT_B, {&PORTD, PD7}, {&PORTD, PD6}, {&PORTD, PD5}, SEGMENT_F, {&PORTD, PD2}}}},
+	{{CATHODE_1, CATHODE_10}}
 };
 
-// LEDアレイ
+// LEDアレイ。led_scanの全スロットの像に書く
 class game_bar
 {
 public:
-	game_bar(const array<output_pin, 10>& pin) : m_pin(pin) {}
+	static constexpr int LENGTH = 10;
+
+	game_bar(const array<scan_pin, LENGTH>& pin) : m_pin(pin) {}
 
+	// スキャンの対象にする。Lowで点灯
 	void init() {
 		for (auto& p : m_pin) {
-			p.set();
+			led_scan.claim(p, true);
 		}
 	}
 
 	void set_position(int pos) {
-		if (pos < 0 || pos >= 10) return;
+		if (pos < 0 || pos >= LENGTH || pos == m_pos) return;
 		if (m_pos != BAR_INVALID) {
-			m_pin[m_pos].set();
+			led_scan.write_all(m_pin[m_pos], true);
 		}
 		m_pos = pos;
-		m_pin[pos].reset();
+		led_scan.write_all(m_pin[pos], false);
 	}
 
 	void erase() {
 		if (m_pos == BAR_INVALID) return;
-		m_pin[m_pos].set();
+		led_scan.write_all(m_pin[m_pos], true);
 		m_pos = BAR_INVALID;
 	}
 
+	// 輝度調整の消灯と点灯はled_scanが行うので、何もしない
+	void blank() {}
+	void unblank() {}
+
 private:
-	array<output_pin, 10> m_pin;
+	array<scan_pin, LENGTH> m_pin;
 	static constexpr int BAR_INVALID = -1;    // -1をトラップ表現(バー非表示)として使う
 	int m_pos = BAR_INVALID;
 };
 
+#if BAR_SPI_LENGTH
+shift_register_bar<BAR_SPI_LENGTH> bar;
+#else
 game_bar bar{{{{&PORTB, PB2}, {&PORTB, PB3}, {&PORTB, PB4}, {&PORTB, PB5}, {&PORTC, PC0}, {&PORTC, PC1}, {&PORTC, PC2}, {&PORTC, PC3}, {&PORTC, PC4}, {&PORTC, PC5}}}};
-
+#endif
+
+// バーのLEDの数。バーが往復してから端に戻るまでの位置の数は2 * BAR_LENGTH - 1
+constexpr int BAR_LENGTH = decltype(bar)::LENGTH;
+// 帰り道の最後のこの数の位置でボタンを押せば成功
+constexpr int HIT_WINDOW = 3;
+constexpr int HIT_START = 2 * BAR_LENGTH - 1 - HIT_WINDOW;
+constexpr int ROUND_TRIP = 2 * BAR_LENGTH - 1;
+
+#if SOUND == SOUND_OC1A
+input_pin game_switch RELOCATED_INPUT;
+#else
 input_pin game_switch{&PINB, PB1};
+#endif
+#if HAS_HIGH_SCORE_SWITCH
 input_pin high_score_switch{&PIND, PD4};
+#else
+no_input_pin high_score_switch;
+#endif
+#if HAS_ERASE_SWITCH
 input_pin erase_score_switch{&PINB, PB0};
+#else
+no_input_pin erase_score_switch;
+#endif
+
+sound_type sound;
+display_brightness brightness;
+supply_monitor supply;
+persistent_store persistent{supply};
+power_fail_detector power_fail;
+#if TICKLESS_PLAY
+bar_step_timer bar_timer;
+#endif
+
+#if USE_UART
+uart_port uart;
+record_writer records{uart};
+#endif
+#if TELEMETRY
+telemetry_stream telemetry{records};
+#else
+telemetry_stream telemetry;
+#endif
+#if REMOTE_COMMAND
+command_parser commands;
+#endif
+#if VERSUS
+versus_link versus{uart};
+#endif
+
+// イベントトレース。GDBやhokey-simからシンボル名で読むので、名前を変えないこと
+trace_buffer_type trace_buffer;
+
+inline void trace(trace_event event, uint8_t arg)
+{
+	trace_buffer.record(static_cast<uint16_t>(global_timer), event, arg);
+}
 
 // ハイスコア管理。Singleton
 class high_score_manager
@@ -279,30 +413,212 @@ public:
 	void update_high_score(uint8_t score) {
 		if (score > m_high_score) {
 			m_high_score = score;
-			eeprom_busy_wait();
-			eeprom_write_byte(&high_score_eeprom, m_high_score);
+			warm_resume::instance().set(&warm_image::high_score, m_high_score);
+			trace(trace_event::eeprom_write, m_high_score);
+			persistent.write(persistent_id::high_score, &high_score_eeprom, m_high_score);
 		}
 	}
 
+	// 電源投入時にEEPROMから読んだ値が範囲内だったか。自己診断用
+	bool record_valid() const {
+		return m_record_valid;
+	}
+
 	void erase_hight_score() {
 		if (m_high_score == 0) return;
 		m_high_score = 0;
-		eeprom_busy_wait();
-		eeprom_write_byte(&high_score_eeprom, m_high_score);
+		warm_resume::instance().set(&warm_image::high_score, m_high_score);
+		trace(trace_event::eeprom_write, m_high_score);
+		persistent.write(persistent_id::high_score, &high_score_eeprom, m_high_score);
 	}
 
 private:
 	high_score_manager() {
+		auto& warm = warm_resume::instance();
+		if (warm.valid()) {
+			m_high_score = warm.image().high_score;
+			// 書き込み待ち(ライトバック、電圧が低くて後回しにしたもの)の印が消えているので付け直す。
+			// 書き込み済みならflushのeeprom_update_byteが読んで比べるだけで、書き換えない
+			persistent.write(persistent_id::high_score, &high_score_eeprom, m_high_score);
+			return;
+		}
 		eeprom_busy_wait();
 		m_high_score = eeprom_read_byte(&high_score_eeprom);
+		m_record_valid = m_high_score <= MAX_SCORE;
+		warm.set(&warm_image::high_score, m_high_score);
 	}
 
 	static uint8_t high_score_eeprom EEMEM;
 	uint8_t m_high_score;
+	bool m_record_valid = true;
 };
 
 uint8_t high_score_manager::high_score_eeprom EEMEM = 0;
 
+// 難易度の管理。EEPROMに保存する。Singleton
+class difficulty_manager
+{
+public:
+	static constexpr uint8_t PROFILE_COUNT = 3;
+
+	// バーの速さの決め方。ゲーム開始時の待ち時間と、何点ごとに1ティック速くなるか
+	struct profile
+	{
+		int initial_wait;
+		int score_per_step;
+	};
+
+	static difficulty_manager& instance() {
+		static difficulty_manager object;
+		return object;
+	}
+
+	uint8_t get_difficulty() const {
+		return m_difficulty;
+	}
+
+	const profile& get_profile() const {
+		return profiles[m_difficulty];
+	}
+
+	// 対戦では招待した側の難易度を使う
+	static const profile& get_profile(uint8_t difficulty) {
+		return profiles[difficulty < PROFILE_COUNT ? difficulty : NORMAL];
+	}
+
+	// 電源投入時にEEPROMから読んだ値が範囲内だったか。自己診断用
+	bool record_valid() const {
+		return m_record_valid;
+	}
+
+	bool set_difficulty(uint8_t difficulty) {
+		if (difficulty >= PROFILE_COUNT) return false;
+		if (difficulty == m_difficulty) return true;
+		m_difficulty = difficulty;
+		warm_resume::instance().set(&warm_image::difficulty, m_difficulty);
+		trace(trace_event::eeprom_write, m_difficulty);
+		persistent.write(persistent_id::difficulty, &difficulty_eeprom, m_difficulty);
+		return true;
+	}
+
+private:
+	difficulty_manager() {
+		auto& warm = warm_resume::instance();
+		if (warm.valid() && warm.image().difficulty < PROFILE_COUNT) {
+			m_difficulty = warm.image().difficulty;
+			persistent.write(persistent_id::difficulty, &difficulty_eeprom, m_difficulty);
+			return;
+		}
+		eeprom_busy_wait();
+		m_difficulty = eeprom_read_byte(&difficulty_eeprom);
+		if (m_difficulty >= PROFILE_COUNT) {
+			m_difficulty = NORMAL;    // 書き込んだことがないEEPROMは0xFF
+			m_record_valid = false;
+		}
+		warm.set(&warm_image::difficulty, m_difficulty);
+	}
+
+	static constexpr uint8_t NORMAL = 1;
+	static constexpr profile profiles[PROFILE_COUNT] {{36, 6}, {30, 5}, {24, 4}};
+
+	static uint8_t difficulty_eeprom EEMEM;
+	uint8_t m_difficulty;
+	bool m_record_valid = true;
+};
+
+constexpr difficulty_manager::profile difficulty_manager::profiles[difficulty_manager::PROFILE_COUNT];
+uint8_t difficulty_manager::difficulty_eeprom EEMEM = difficulty_manager::NORMAL;
+
+// 起動してからのプレイ記録。POWER_FAILのときはEEPROMに残し、通算の記録にする。Singleton
+class statistics_manager
+{
+public:
+	static statistics_manager& instance() {
+		static statistics_manager object;
+		return object;
+	}
+
+	void count_game() {
+		++m_games;
+		warm_resume::instance().set(&warm_image::games, m_games);
+		store();
+	}
+
+	void count_hit() {
+		++m_hits;
+		warm_resume::instance().set(&warm_image::hits, m_hits);
+		store();
+	}
+
+	uint16_t get_games() const {
+		return m_games;
+	}
+
+	uint16_t get_hits() const {
+		return m_hits;
+	}
+
+private:
+	// ウォッチドッグのリセットから再開したときは続きから数える
+	statistics_manager() {
+		auto& warm = warm_resume::instance();
+		if (warm.valid()) {
+			m_games = warm.image().games;
+			m_hits = warm.image().hits;
+			store();
+			return;
+		}
+#if POWER_FAIL
+		eeprom_busy_wait();
+		m_games = eeprom_read_word(&games_eeprom);
+		m_hits = eeprom_read_word(&hits_eeprom);
+		if (m_games == 0xFFFF) {
+			m_games = 0;    // 書き込んだことがないEEPROM
+			m_hits = 0;
+		}
+		warm.set(&warm_image::games, m_games);
+		warm.set(&warm_image::hits, m_hits);
+#endif
+	}
+
+	// ライトバックなので、ゲームのたびにEEPROMを書き換えることはない
+	void store() {
+#if POWER_FAIL
+		persistent.write(persistent_id::games, &games_eeprom, m_games);
+		persistent.write(persistent_id::hits, &hits_eeprom, m_hits);
+#endif
+	}
+
+	uint16_t m_games = 0;
+	uint16_t m_hits = 0;
+#if POWER_FAIL
+	static uint16_t games_eeprom EEMEM;
+	static uint16_t hits_eeprom EEMEM;
+#endif
+};
+
+#if POWER_FAIL
+uint16_t statistics_manager::games_eeprom EEMEM = 0;
+uint16_t statistics_manager::hits_eeprom EEMEM = 0;
+#endif
+
+// game_managerの状態。テレメトリでも送る
+enum class game_state : uint8_t
+{
+	ready_to_start,
+	show_high_score,
+	playing,
+	show_score_blink,
+	show_score,
+	diagnostics,
+	self_test_fault,    // 電源投入時の自己診断の異常コードを表示している
+	versus_waiting,    // 対戦の招待を送って返事を待っている
+	versus_playing,
+};
+
+// game_managerのスクリプトの中でnティック待つ。待つ間はタイマホイールが数えるので、ティックごとの処理はない
+#define AWAIT_TICKS(n) CORO_AWAIT(m_script, m_timers.schedule(TIMER_SCRIPT, (n), &game_manager::resume_script))
+
 // ゲーム管理。Singleton
 class game_manager
 {
@@ -313,178 +629,1031 @@ public:
 	}
 
 	void update() {
-		(this->*m_update_func)();
+		PROBE_SPAN(probe_id::game_update);
+#if TRACE_DEPTH
+		trace_switches();
+#endif
+		{
+			PROBE_SPAN(probe_id::timer_wheel);
+			m_timers.advance(*this);
+		}
+#if VERSUS
+		// 招待を受ける状態と対戦中以外に届いたもの(1人でプレイしている間の招待など)は捨てる。
+		// 残しておくと、相手がタイムアウトして1人で始めたあとに受けてしまう
+		if (!uses_control(m_state)) {
+			versus.discard_control();
+		}
+#endif
+		{
+			PROBE_SPAN(probe_id::state_update);
+			(this->*m_update_func)();
+		}
+#if REMOTE_COMMAND
+		command_protocol::command command;
+		if (commands.take(command)) {
+			PROBE_SPAN(probe_id::command);
+			execute(command);
+		}
+#if TRACE_DEPTH
+		export_trace();
+#endif
+#endif
 	}
 
 private:
-	game_manager() : m_update_func(&game_manager::ready_to_start) {}
+	using update_func = void (game_manager::*)();
 
-	void init_game() {
+	game_manager() {
+		auto& warm = warm_resume::instance();
+		if (warm.valid()) {
+			resume(static_cast<game_state>(warm.image().state), warm.image().score);
+		} else {
+			change_state(game_state::ready_to_start);
+		}
+	}
+
+	// ウォッチドッグのリセットから再開する。プレイ中だったときは、スコアはそのままでバーを端から出し直す
+	void resume(game_state state, uint8_t score) {
+		m_score = score > MAX_SCORE ? MAX_SCORE : score;
+		switch (state) {
+		case game_state::playing:
+			serve();
+			break;
+		case game_state::show_high_score:
+		case game_state::show_score_blink:
+		case game_state::show_score:
+			change_state(state);
+			break;
+		default:
+			change_state(game_state::ready_to_start);
+			break;
+		}
+	}
+
+public:
+	// 自己診断で異常があれば、コードを表示してから待機状態になる
+	void report_self_test(const self_test_report& report) {
+		if (report.empty()) return;
+		m_self_test_report = report;
+		for (auto fault : report) {
+			trace(trace_event::self_test, static_cast<uint8_t>(fault));
+		}
+		change_state(game_state::self_test_fault);
+	}
+
+private:
+	// 状態ごとのタイマ。状態遷移で全部取り消す
+	enum timer_id : uint8_t
+	{
+		TIMER_BAR_STEP,    // バーを1つ進める(周期はm_bar_speed_recip)
+		TIMER_LOCKOUT,    // ボタンを離してからの無効時間
+		TIMER_SCRIPT,    // スクリプトの再開(AWAIT_TICKS)
+		TIMER_ANIMATION,    // ハイスコアのときのバー
+		TIMER_STATE,    // 対戦の招待のタイムアウト
+		TIMER_COUNT,
+	};
+
+	// 点滅やタイムアウトの長さ(ティック)
+	static constexpr uint16_t BLINK_TICKS = FRAME_PER_SEC / 2;
+	static constexpr uint8_t SHOW_SCORE_BLINKS = 3;    // 点滅の回数(1回が1秒)
+	static constexpr uint16_t LOCKOUT_TICKS = FRAME_PER_SEC / 10;
+	static constexpr uint16_t FAULT_CODE_TICKS = FRAME_PER_SEC;    // 異常コードを1つ表示する長さ。間は1/4
+	// 難易度の待ち時間とテレメトリの時間の単位(Timer0の256カウント、約2ms)
+	static constexpr uint16_t WAIT_UNIT_COUNTS = BASE_TICK_COUNTS;
+#if VERSUS
+	// 対戦の1フレーム(ティック)。FAST_TICKのときも約2msごとに進める
+	static constexpr uint16_t VERSUS_FRAME_TICKS = BASE_TICK_COUNTS / TICK_COUNTS;
+	static constexpr uint16_t VERSUS_INVITE_TICKS = FRAME_PER_SEC / 10;    // 返事がなければ1人で始める
+#endif
+
+	// 状態遷移。待機中の状態ではクロックを落とす
+	void change_state(game_state state) {
+		static constexpr update_func update_funcs[] {
+			&game_manager::ready_to_start,
+			&game_manager::show_high_score,
+			&game_manager::playing,
+			&game_manager::show_score_blink,
+			&game_manager::show_score,
+			&game_manager::diagnostics,
+			&game_manager::self_test_fault,
+#if VERSUS
+			&game_manager::versus_waiting,
+			&game_manager::versus_playing,
+#endif
+		};
+		m_state = state;
+		m_update_func = update_funcs[static_cast<uint8_t>(state)];
+		warm_resume::instance().set(&warm_image::state, static_cast<uint8_t>(state));
+		trace(trace_event::state, static_cast<uint8_t>(state));
+		GPIOR1 = static_cast<uint8_t>(state);    // hokey-simが状態ごとのCPU負荷を測るのに使う
+		if (state == game_state::playing || state == game_state::show_score_blink || state == game_state::versus_playing) {
+			clock_profile::instance().set_level(clock_level::full);
+		} else {
+			clock_profile::instance().set_level(clock_level::idle);
+		}
+		m_timers.cancel_all();
+		enter_state(state);
+	}
+
+	// 状態に入ったときの表示とタイマ
+	void enter_state(game_state state) {
+		switch (state) {
+		case game_state::show_score_blink:
+			bar.erase();
+			if (m_update_high_score) {
+				// ハイスコアをとった場合は1秒後からバーが暴れる
+				m_timers.schedule(TIMER_ANIMATION, FRAME_PER_SEC, &game_manager::random_bar, FRAME_PER_SEC / 20);
+			}
+			start_script(&game_manager::score_blink_script);
+			break;
+		case game_state::diagnostics:
+			m_diagnostics_pressed = false;
+			start_script(&game_manager::diagnostics_script);
+			break;
+		case game_state::self_test_fault:
+			bar.erase();
+			start_script(&game_manager::self_test_script);
+			break;
+#if VERSUS
+		case game_state::versus_waiting:
+			m_timers.schedule(TIMER_STATE, VERSUS_INVITE_TICKS, &game_manager::invite_timeout);
+			break;
+		case game_state::versus_playing:
+			show_versus();
+			m_timers.schedule(TIMER_BAR_STEP, VERSUS_FRAME_TICKS, &game_manager::versus_frame, VERSUS_FRAME_TICKS);
+			break;
+#endif
+		default:
+			break;
+		}
+	}
+
+#if REMOTE_COMMAND
+	// リモートコマンドの実行。プレイ中は状態を返すだけにして、ゲームの進行に影響させない
+	void execute(const command_protocol::command& command) {
+		using command_protocol::command_id;
+		using telemetry_protocol::result;
+		trace(trace_event::command, static_cast<uint8_t>(command.id));
+		if (command.id == command_id::get_status) {
+			uint16_t games = statistics_manager::instance().get_games();
+			uint16_t hits = statistics_manager::instance().get_hits();
+			records.put<telemetry_protocol::record_type::status>(
+				high_score_manager::instance().get_high_score(),
+				difficulty_manager::instance().get_difficulty(),
+				static_cast<uint8_t>(m_state),
+				static_cast<uint8_t>(games), static_cast<uint8_t>(games >> 8),
+				static_cast<uint8_t>(hits), static_cast<uint8_t>(hits >> 8));
+			return;
+		}
+		if (command.id == command_id::dump_trace) {
+#if TRACE_DEPTH
+			// 送るのはexport_traceで1ティックに1レコードずつ。読み出すだけなのでプレイ中でも受け付ける
+			if (m_trace_remaining == 0) {
+				m_trace_index = trace_buffer.head();
+				m_trace_remaining = trace_buffer.depth();
+			}
+#else
+			records.put<telemetry_protocol::record_type::ack>(static_cast<uint8_t>(command.id), static_cast<uint8_t>(result::invalid));
+#endif
+			return;
+		}
+		result r = result::ok;
+		if (m_state == game_state::playing || m_state == game_state::show_score_blink) {
+			r = result::busy;
+		} else if (command.id == command_id::set_difficulty) {
+			if (!difficulty_manager::instance().set_difficulty(command.argument)) {
+				r = result::invalid;
+			}
+		} else if (command.id == command_id::erase_score) {
+			high_score_manager::instance().erase_hight_score();
+		} else if (command.id == command_id::diagnostics) {
+			change_state(game_state::diagnostics);
+		} else {
+			r = result::invalid;
+		}
+		records.put<telemetry_protocol::record_type::ack>(static_cast<uint8_t>(command.id), static_cast<uint8_t>(r));
+	}
+
+#if TRACE_DEPTH
+	// dump_traceの送信。送信バッファが空いていなければ次のティックに回す
+	void export_trace() {
+		if (m_trace_remaining == 0) return;
+		const trace_record& r = trace_buffer.at(m_trace_index);
+		if (r.event != trace_event::none) {
+			if (!records.put<telemetry_protocol::record_type::trace>(
+					static_cast<uint8_t>(r.time), static_cast<uint8_t>(r.time >> 8), static_cast<uint8_t>(r.event), r.arg)) {
+				return;
+			}
+		}
+		++m_trace_index;
+		if (--m_trace_remaining == 0) {
+			records.put<telemetry_protocol::record_type::ack>(
+				static_cast<uint8_t>(command_protocol::command_id::dump_trace), static_cast<uint8_t>(telemetry_protocol::result::ok));
+		}
+	}
+#endif
+#endif
+
+#if TRACE_DEPTH
+	// スイッチが変化したときだけ記録する
+	void trace_switches() {
+		uint8_t switches = static_cast<uint8_t>((game_switch.read() ? 0 : 1) | (high_score_switch.read() ? 0 : 2) | (erase_score_switch.read() ? 0 : 4));
+		if (switches != m_traced_switches) {
+			m_traced_switches = switches;
+			trace(trace_event::switches, switches);
+		}
+	}
+#endif
+
+	// ゲームスイッチで始める。VERSUSのときは先に対戦の招待を送り、返事がなければ1人で始める
+	void press_start() {
+#if VERSUS
+		invite();
+#else
+		start_game();
+#endif
+	}
+
+	void start_game() {
 		srand(static_cast<unsigned int>(global_timer));
 
 		m_score = 0;
+		warm_resume::instance().set(&warm_image::score, static_cast<uint8_t>(m_score));
+		telemetry.game_start();
+		serve();
+	}
+
+	// バーを端から出してプレイを始める
+	void serve() {
 		m_position = 0;
-		m_bar_count = 0;
-		m_bar_speed_recip = calc_speed_recip();
-		m_button_invalid_time = 0;
+		// クロックを全速にしてからTimer1を動かす
+		change_state(game_state::playing);
+#if TICKLESS_PLAY
+		score_display.set_number(static_cast<uint32_t>(m_score));
+		show_bar();
+		m_release_tick = static_cast<uint16_t>(global_timer - LOCKOUT_TICKS);
+		bar_timer.start(next_step_counts());
+		PCIFR = _BV(PCIF0);
+		PCICR = static_cast<uint8_t>(PCICR | _BV(PCIE0));
+#else
+		// ゲームスイッチを押して始めるので、離すまでは無効
+		m_button_pressed = true;
+		m_button_locked = true;
+		schedule_bar_step();
+#endif
 	}
 
-	int calc_speed_recip() {
-		int value = ((30 - m_score / 5) * (80 + rand() % 40) + 50) / 100;
+	// 1歩の待ち時間をunit倍で返す(unitは1ティックをいくつに分けて数えるか)
+	uint32_t calc_wait(uint16_t unit) {
+		const auto& profile = difficulty_manager::instance().get_profile();
+		int32_t value = (static_cast<int32_t>(profile.initial_wait - m_score / profile.score_per_step) * (80 + rand() % 40) * unit + 50) / 100;
 		if (value <= 0) return 1;
-		return value;
+		return static_cast<uint32_t>(value);
+	}
+
+	// バーが1つ進むティック数。難易度の待ち時間はWAIT_UNIT_COUNTS単位なので、ティックに換算する
+	int calc_speed_recip() {
+		uint32_t ticks = (calc_wait(WAIT_UNIT_COUNTS) + TICK_COUNTS / 2) / TICK_COUNTS;
+		return ticks == 0 ? 1 : static_cast<int>(ticks);
+	}
+
+	// ティック数を約2ms単位にする(FAST_TICKでなければそのまま)。テレメトリの時間はこの単位
+	static uint8_t to_wait_units(uint32_t ticks) {
+		uint32_t units = ticks * TICK_COUNTS / WAIT_UNIT_COUNTS;
+		return static_cast<uint8_t>(units > 0xFF ? 0xFF : units);
 	}
 
+#if TICKLESS_PLAY
+public:
+	// TIMER1_COMPA_vectから呼ぶ。バーを1つ進める
+	void on_bar_step() {
+		bar_timer.advance();
+		++m_position;
+		if (m_position >= ROUND_TRIP) {
+			game_over();
+			return;
+		}
+		show_bar();
+	}
+
+	// PCINT0_vectから呼ぶ。押した瞬間に判定する。離してからLOCKOUT_TICKSの間は無効(チャタリング、連打防止)
+	// ティックで動かすときと違い、ティックの中で判定しないのでタイマホイールは使わない
+	void on_game_switch() {
+		uint16_t now = static_cast<uint16_t>(global_timer);
+		if (game_switch.read()) {
+			m_release_tick = now;
+			return;
+		}
+		if (m_position < HIT_START || static_cast<uint16_t>(now - m_release_tick) < LOCKOUT_TICKS) return;
+		uint32_t offset = (static_cast<uint32_t>(m_position - HIT_START) * bar_timer.interval() + bar_timer.elapsed()) / bar_step_timer::COUNTS_PER_TICK;
+		hit(offset);
+		score_display.set_number(static_cast<uint32_t>(m_score));
+		show_bar();
+		bar_timer.restart(next_step_counts());
+	}
+
+private:
+	// 次の1歩のTimer1のカウント数。テレメトリ用にティック数も更新する
+	uint16_t next_step_counts() {
+		uint32_t counts = calc_wait(WAIT_UNIT_COUNTS);
+		if (counts > 0xFFFF) counts = 0xFFFF;
+		m_bar_speed_recip = static_cast<int>((counts + bar_step_timer::COUNTS_PER_TICK / 2) / bar_step_timer::COUNTS_PER_TICK);
+		return static_cast<uint16_t>(counts);
+	}
+#endif
+
 	void ready_to_start() {
+#if VERSUS
+		if (accept_invite()) return;
+#endif
 		score_display.set_number(0);
 		bar.set_position(0);
 		if (!erase_score_switch.read()) {
 			high_score_manager::instance().erase_hight_score();
 		}
 		if (!game_switch.read()) {
-			init_game();
-			m_update_func = &game_manager::playing;
+			press_start();
 		} else if (!high_score_switch.read()) {
-			m_update_func = &game_manager::show_high_score;
+			change_state(game_state::show_high_score);
 		}
 	}
 
 	void show_high_score() {
+#if VERSUS
+		if (accept_invite()) return;
+#endif
 		score_display.set_number(high_score_manager::instance().get_high_score());
 		if (!erase_score_switch.read()) {
 			high_score_manager::instance().erase_hight_score();
 		}
 		if (!game_switch.read()) {
-			init_game();
-			m_update_func = &game_manager::playing;
+			press_start();
 		}
 	}
 
 	void playing() {
+#if TICKLESS_PLAY
+		// バーはTimer1のコンペアマッチ(on_bar_step)、ボタンはピン変化割り込み(on_game_switch)で動かす
+#else
+		// バーはTIMER_BAR_STEPで進める
 		score_display.set_number(static_cast<uint32_t>(m_score));
-		if (m_position < 10) {
-			bar.set_position(m_position);
-		} else if (m_position < 19) {
-			bar.set_position(19 - 1 - m_position);
-		} else {
-			bar.set_position(0);
+		show_bar();
+		bool pressed = !game_switch.read();
+		if (pressed && !m_button_locked && m_position >= HIT_START) {
+			hit(static_cast<uint32_t>((m_position - HIT_START) * m_bar_speed_recip) + static_cast<uint16_t>(global_timer - m_step_tick));
+			schedule_bar_step();
 		}
-		++m_bar_count;
-		if (m_bar_count >= m_bar_speed_recip) {
-			m_bar_count = 0;
-			++m_position;
-			if (m_position >= 19) {
-				if (m_score > high_score_manager::instance().get_high_score()) {
-					m_update_high_score = true;
-					high_score_manager::instance().update_high_score(static_cast<uint8_t>(m_score));
-				} else {
-					m_update_high_score = (m_score == MAX_SCORE);
-				}
-				m_update_func = &game_manager::show_score_blink;
-				m_blink_count = 0;
-				return;
+		// チャタリング防止かつ連打防止のため、押している間と離してからLOCKOUT_TICKSの間はボタンを無効にする
+		if (pressed != m_button_pressed) {
+			m_button_pressed = pressed;
+			if (pressed) {
+				m_button_locked = true;
+				m_timers.cancel(TIMER_LOCKOUT);
+			} else {
+				m_timers.schedule(TIMER_LOCKOUT, LOCKOUT_TICKS, &game_manager::unlock_button);
 			}
 		}
-		if (m_position >= 16 && m_button_invalid_time == 0 && !game_switch.read()) {
-			++m_score;
-			if (m_score > MAX_SCORE) m_score = MAX_SCORE;
-			m_position = 0;
-			m_bar_count = 0;
-			m_bar_speed_recip = calc_speed_recip();
-		}
-		if (!game_switch.read()) {
-			m_button_invalid_time = FRAME_PER_SEC / 10;
-		} else if (m_button_invalid_time > 0) {
-			--m_button_invalid_time;
+#endif
+	}
+
+#if !TICKLESS_PLAY
+	// 速さを決め直して、そこから1歩ずつ進める
+	void schedule_bar_step() {
+		m_bar_speed_recip = calc_speed_recip();
+		m_step_tick = static_cast<uint16_t>(global_timer);
+		m_timers.schedule(TIMER_BAR_STEP, static_cast<uint16_t>(m_bar_speed_recip), &game_manager::step_bar, static_cast<uint16_t>(m_bar_speed_recip));
+	}
+
+	void step_bar() {
+		m_step_tick = static_cast<uint16_t>(global_timer);
+		++m_position;
+		if (m_position >= ROUND_TRIP) {
+			game_over();
 		}
 	}
 
-	void show_score_blink() {
-		if (m_blink_count % FRAME_PER_SEC < FRAME_PER_SEC / 2) {
-			score_display.set_number(static_cast<uint32_t>(m_score));
+	void unlock_button() {
+		m_button_locked = false;
+	}
+#endif
+
+	void show_bar() {
+		if (m_position < BAR_LENGTH) {
+			bar.set_position(m_position);
+		} else if (m_position < ROUND_TRIP) {
+			bar.set_position(ROUND_TRIP - 1 - m_position);
 		} else {
-			score_display.erase_number();
+			bar.set_position(0);
 		}
-		if (m_blink_count > FRAME_PER_SEC && m_update_high_score) {
-			// ハイスコアをとった場合はバーが暴れる
-			if (m_blink_count % (FRAME_PER_SEC / 20) == 0) {
-				bar.set_position(rand() % 10);
-			}
+	}
+
+	// 打ち返した。offsetは判定範囲に入ってからのティック数
+	void hit(uint32_t offset) {
+		++m_score;
+		if (m_score > MAX_SCORE) m_score = MAX_SCORE;
+		warm_resume::instance().set(&warm_image::score, static_cast<uint8_t>(m_score));
+		statistics_manager::instance().count_hit();
+		sound.play(sound_effect::hit);
+		trace(trace_event::hit, static_cast<uint8_t>(m_score));
+		telemetry.hit(static_cast<uint8_t>(m_score), to_wait_units(offset), to_wait_units(static_cast<uint32_t>(m_bar_speed_recip)));
+		m_position = 0;
+	}
+
+	void game_over() {
+		statistics_manager::instance().count_game();
+		trace(trace_event::game_over, static_cast<uint8_t>(m_score));
+		telemetry.game_over(static_cast<uint8_t>(m_score), to_wait_units(static_cast<uint32_t>(m_bar_speed_recip)));
+		if (m_score > high_score_manager::instance().get_high_score()) {
+			m_update_high_score = true;
+			high_score_manager::instance().update_high_score(static_cast<uint8_t>(m_score));
+			telemetry.high_score(static_cast<uint8_t>(m_score));
+			sound.play(sound_effect::high_score);
 		} else {
-			bar.erase();
+			m_update_high_score = (m_score == MAX_SCORE);
+			sound.play(sound_effect::game_over);
 		}
-		++m_blink_count;
-		if (m_blink_count >= FRAME_PER_SEC * 3) {
-			m_update_func = &game_manager::show_score;
+#if TICKLESS_PLAY
+		bar_timer.stop();
+		PCICR = static_cast<uint8_t>(PCICR & ~_BV(PCIE0));
+#endif
+		change_state(game_state::show_score_blink);
+	}
+
+	// 表示はscore_blink_scriptで切り替える
+	void show_score_blink() {
+	}
+
+	void score_blink_script() {
+		CORO_BEGIN(m_script);
+		for (m_script_count = 0; m_script_count < SHOW_SCORE_BLINKS; ++m_script_count) {
+			score_display.set_number(static_cast<uint32_t>(m_score));
+			AWAIT_TICKS(BLINK_TICKS);
+			score_display.erase_number();
+			AWAIT_TICKS(BLINK_TICKS);
 		}
+		CORO_END(m_script);
+		change_state(game_state::show_score);
+	}
+
+	void random_bar() {
+		bar.set_position(rand() % BAR_LENGTH);
 	}
 
 	void show_score() {
+#if VERSUS
+		if (accept_invite()) return;
+#endif
 		bar.set_position(0);
 		score_display.set_number(static_cast<uint32_t>(m_score));
 		if (!erase_score_switch.read()) {
 			high_score_manager::instance().erase_hight_score();
 		}
 		if (!game_switch.read()) {
-			init_game();
-			m_update_func = &game_manager::playing;
+			press_start();
 		} else if (!high_score_switch.read()) {
-			m_update_func = &game_manager::show_high_score;
+			change_state(game_state::show_high_score);
+		}
+	}
+
+	// 診断画面。7セグを全点灯し、バーを順に点灯する。ゲームスイッチを押して離すと戻る
+	void diagnostics() {
+		if (!game_switch.read()) {
+			m_diagnostics_pressed = true;
+		} else if (m_diagnostics_pressed) {
+			change_state(game_state::ready_to_start);
+		}
+	}
+
+	// バーが1周するごとに、全点灯と電源電圧(0.1V単位、SUPPLY_MONITORのとき)を交互に表示する。
+	// 電圧が低いときは電圧を点滅させる
+	void diagnostics_script() {
+		CORO_BEGIN(m_script);
+		for (;;) {
+			score_display.set_number(88);
+			for (m_script_count = 0; m_script_count < BAR_LENGTH; ++m_script_count) {
+				bar.set_position(m_script_count);
+				AWAIT_TICKS(FRAME_PER_SEC / BAR_LENGTH);
+			}
+#if SUPPLY_MONITOR
+			for (m_script_count = 0; m_script_count < BAR_LENGTH; ++m_script_count) {
+				bar.set_position(m_script_count);
+				if (supply.low() && (m_script_count & 1) != 0) {
+					score_display.erase_number();
+				} else {
+					score_display.set_number(supply.millivolts() / 100u);
+				}
+				AWAIT_TICKS(FRAME_PER_SEC / BAR_LENGTH);
+			}
+#endif
+		}
+		CORO_END(m_script);
+	}
+
+	// 表示はself_test_scriptで切り替える
+	void self_test_fault() {
+	}
+
+	// 異常コードを1つずつ表示する。全部を2回表示したら待機状態に戻る
+	void self_test_script() {
+		CORO_BEGIN(m_script);
+		for (m_script_count = 0; m_script_count < 2 * m_self_test_report.size(); ++m_script_count) {
+			{
+				uint8_t i = m_script_count < m_self_test_report.size() ? m_script_count : static_cast<uint8_t>(m_script_count - m_self_test_report.size());
+				score_display.set_number(static_cast<uint8_t>(m_self_test_report[i]));
+			}
+			AWAIT_TICKS(FAULT_CODE_TICKS);
+			score_display.erase_number();
+			AWAIT_TICKS(FAULT_CODE_TICKS / 4);
 		}
+		CORO_END(m_script);
+		change_state(game_state::ready_to_start);
+	}
+
+#if VERSUS
+	// 招待、受諾、中断を読む状態
+	static bool uses_control(game_state state) {
+		switch (state) {
+		case game_state::ready_to_start:
+		case game_state::show_high_score:
+		case game_state::show_score:
+		case game_state::versus_waiting:
+		case game_state::versus_playing:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// 対戦の招待を送る。乱数の種の下位4ビットはこちらで、上位5ビットは受けた側で決める。
+	// 招待の返事より先に相手の入力が届くことはないが、受諾の直後から届くので、先に受け付けておく
+	void invite() {
+		m_versus_seed = static_cast<uint8_t>(global_timer & 0x0F);
+		m_versus_difficulty = difficulty_manager::instance().get_difficulty();
+		versus.start();
+		versus.send_control(versus_protocol::invite(m_versus_difficulty, m_versus_seed));
+		change_state(game_state::versus_waiting);
+	}
+
+	// 待機中に招待が届いていれば受ける
+	bool accept_invite() {
+		uint8_t byte;
+		if (!versus.take_control(byte) || !versus_protocol::is_invite(byte)) return false;
+		accept(byte);
+		return true;
+	}
+
+	// 受けた側がプレイヤー1
+	void accept(uint8_t invite_byte) {
+		uint8_t seed = static_cast<uint8_t>(global_timer & 0x1F);
+		versus.start();
+		versus.send_control(versus_protocol::accept(seed));
+		start_versus(1, versus_protocol::invite_difficulty(invite_byte), static_cast<uint16_t>(versus_protocol::invite_seed(invite_byte) | seed << 4));
+	}
+
+	void versus_waiting() {
+		using namespace versus_protocol;
+		uint8_t byte;
+		if (!versus.take_control(byte)) return;
+		if (is_accept(byte)) {
+			start_versus(0, m_versus_difficulty, static_cast<uint16_t>(m_versus_seed | accept_seed(byte) << 4));
+		} else if (is_invite(byte)) {
+			// 同時に招待した。種の大きい方が招待した側のまま受諾を待ち、小さい方が受ける。同じなら送り直す
+			if (invite_seed(byte) > m_versus_seed) {
+				accept(byte);
+			} else if (invite_seed(byte) == m_versus_seed) {
+				invite();
+			}
+		}
+	}
+
+	// 返事がない(相手がいない、プレイ中)
+	void invite_timeout() {
+		versus.stop();
+		start_game();
+	}
+
+	void start_versus(uint8_t player, uint8_t difficulty, uint16_t seed) {
+		const auto& profile = difficulty_manager::get_profile(difficulty);
+		m_versus_player = player;
+		m_match.start(seed, profile.initial_wait, profile.score_per_step);
+		change_state(game_state::versus_playing);
+	}
+
+	// 表示と判定はversus_frameで1フレームごとに行う
+	void versus_playing() {
+	}
+
+	// 1フレーム進める。相手の入力が届いていなければ待つ
+	void versus_frame() {
+		uint8_t byte;
+		if (versus.take_control(byte) && byte == versus_protocol::ABORT) {
+			abort_versus(versus_abort_reason::remote);
+			return;
+		}
+		if (versus.desync()) {
+			abort_versus(versus_abort_reason::desync);
+			return;
+		}
+		if (versus.waiting() >= versus_link::LINK_TIMEOUT_FRAMES) {
+			abort_versus(versus_abort_reason::timeout);
+			return;
+		}
+		bool local;
+		bool remote;
+		if (!versus.exchange(!game_switch.read(), local, remote)) return;
+		uint8_t own_bit = static_cast<uint8_t>(1 << m_versus_player);
+		uint8_t inputs = static_cast<uint8_t>((local ? own_bit : 0) | (remote ? own_bit ^ 0x03 : 0));
+		uint8_t events = m_match.step(inputs);
+		if ((events & versus_match_type::HIT) && m_match.striker() == m_versus_player) {
+			statistics_manager::instance().count_hit();
+			sound.play(sound_effect::hit);
+		}
+		show_versus();
+		if (events & versus_match_type::POINT) {
+			trace(trace_event::versus_point, static_cast<uint8_t>(m_score));
+		}
+		if (events & versus_match_type::FINISHED) {
+			finish_versus();
+		}
+	}
+
+	// スコアは自分の点 × 10 + 相手の点。バーはボールが自分の側にあるときだけ
+	void show_versus() {
+		m_score = m_match.points(m_versus_player) * 10 + m_match.points(static_cast<uint8_t>(1 - m_versus_player));
+		score_display.set_number(static_cast<uint32_t>(m_score));
+		int position = m_match.position_for(m_versus_player);
+		if (position < 0) {
+			bar.erase();
+		} else {
+			bar.set_position(position);
+		}
+	}
+
+	// 勝った側はハイスコアのときと同じようにバーを暴れさせる。対戦の結果はハイスコアにしない
+	void finish_versus() {
+		versus.stop();
+		statistics_manager::instance().count_game();
+		warm_resume::instance().set(&warm_image::score, static_cast<uint8_t>(m_score));
+		m_update_high_score = m_match.winner() == m_versus_player;
+		sound.play(m_update_high_score ? sound_effect::high_score : sound_effect::game_over);
+		change_state(game_state::show_score_blink);
+	}
+
+	void abort_versus(versus_abort_reason reason) {
+		versus.stop();
+		if (reason != versus_abort_reason::remote) {
+			versus.send_control(versus_protocol::ABORT);
+		}
+		trace(trace_event::versus_abort, static_cast<uint8_t>(reason));
+		change_state(game_state::ready_to_start);
+	}
+#endif
+
+	// スクリプトを最初から動かす。待つのはAWAIT_TICKSで、状態が変わるとタイマごと取り消される
+	void start_script(update_func script) {
+		m_script_func = script;
+		m_script.restart();
+		(this->*m_script_func)();
+	}
+
+	void resume_script() {
+		(this->*m_script_func)();
 	}
 
 	// update関数から呼ばれる関数。状態遷移用
-	void (game_manager::*m_update_func)();
+	update_func m_update_func;
+	game_state m_state;
 
 	int m_score;
-	int m_position;    // バーの位置。0～20。10以降が帰り道。18と19(と0)は同じ位置。17, 18, 19の時にボタンを押せば成功
-	int m_bar_count;
+	int m_position;    // バーの位置。0～ROUND_TRIP。BAR_LENGTH以降が帰り道。HIT_START以降にボタンを押せば成功(LEDが10個なら16, 17, 18)
 	int m_bar_speed_recip;    // 待ち時間(速さの逆数)であることに注意
+	uint16_t m_step_tick;    // バーが最後に進んだティック
 
-	// チャタリング防止かつ連打防止のため、ボタンを離したあと一定時間ボタンを無効にするためのカウンタ
-	int m_button_invalid_time;
+	bool m_button_pressed;
+	bool m_button_locked;
 
 	bool m_update_high_score;    // ハイスコアをとったかどうか
-	int m_blink_count;    // スコア表示用
+	bool m_diagnostics_pressed;
+	self_test_report m_self_test_report;
+
+	// 今の状態のスクリプト。m_script_countはスクリプトのループのカウンタ
+	update_func m_script_func;
+	coroutine m_script;
+	uint8_t m_script_count;
+
+	timer_wheel<game_manager, 16, TIMER_COUNT> m_timers;
+#if VERSUS
+	using versus_match_type = versus_match<BAR_LENGTH, HIT_WINDOW>;
+	versus_match_type m_match;
+	uint8_t m_versus_player;    // 0: 招待した側, 1: 受けた側
+	uint8_t m_versus_difficulty;    // 招待したときの難易度
+	uint8_t m_versus_seed;    // 招待で送った種(下位4ビット)
+#endif
+#if TICKLESS_PLAY
+	uint16_t m_release_tick;    // ゲームスイッチを最後に離したティック
+#endif
+
+#if TRACE_DEPTH
+	uint8_t m_traced_switches = 0;
+#if REMOTE_COMMAND
+	uint8_t m_trace_index = 0;    // dump_traceで次に送るレコード
+	uint8_t m_trace_remaining = 0;
+#endif
+#endif
 };
 
+// ティックの処理が最後まで終わったらtrue。メインループがウォッチドッグをリセットする
+volatile bool tick_done = false;
+
 // 初期化
 void io_init();
 void timer_init();
+#if SELF_TEST
+self_test_report self_test();
+#endif
 
 // 割り込みベクタ
-ISR(TIMER0_OVF_vect)
+ISR(TIMER0_COMPA_vect)
 {
+	PROBE_SPAN(probe_id::timer_tick);
 	++global_timer;
-	if (global_timer % 4 == 0) {
-		score_display.change_digit();
+	{
+		// 今のスロットの像を出す。輝度調整でコンペアマッチBのときに消した分もこれで点く
+		PROBE_SPAN(probe_id::led_scan);
+		led_scan.update(static_cast<uint8_t>(global_timer));
+	}
+#if USE_DIMMING
+	{
+		PROBE_SPAN(probe_id::brightness);
+		bar.unblank();
+		brightness.update(supply.low());
+	}
+#endif
+	{
+		PROBE_SPAN(probe_id::supply);
+		supply.update();
+	}
+	persistent.flush();
+	{
+		PROBE_SPAN(probe_id::sound);
+		sound.update();
 	}
 	game_manager::instance().update();
+	tick_done = true;
+}
+
+#if TICKLESS_PLAY
+ISR(TIMER1_COMPA_vect)
+{
+	PROBE_SPAN(probe_id::bar_step);
+	game_manager::instance().on_bar_step();
+}
+
+ISR(PCINT0_vect)
+{
+	PROBE_SPAN(probe_id::game_switch);
+	game_manager::instance().on_game_switch();
 }
+#endif
+
+#if USE_DIMMING
+// 輝度調整。ティックの残りは消灯
+ISR(TIMER0_COMPB_vect)
+{
+	led_scan.blank();
+	bar.blank();
+}
+#endif
+
+#if USE_ADC
+// ADCは光センサと電源電圧の監視で共用する。バンドギャップの値でなければ光センサの値
+ISR(ADC_vect)
+{
+	PROBE_SPAN(probe_id::adc);
+	uint16_t sample = ADC;
+	if (!supply.on_conversion(sample)) {
+		brightness.on_conversion(sample);
+	}
+}
+#endif
+
+#if POWER_FAIL
+// 電源が落ちかけている。ホールドアップの間にLEDを消して電流を減らし、書き込み待ちの値を書く。
+// 書き終わっても電源が戻っていれば、次のティックでそのまま続ける
+ISR(ANALOG_COMP_vect)
+{
+	PROBE_SPAN(probe_id::power_fail);
+	led_scan.blank();
+	bar.blank();
+	uint8_t count = persistent.commit();
+	trace(trace_event::power_fail, count);
+}
+#endif
+
+#if USE_UART
+ISR(USART_UDRE_vect)
+{
+	PROBE_SPAN(probe_id::uart);
+	uart.on_data_register_empty();
+}
+
+ISR(USART_TX_vect)
+{
+	PROBE_SPAN(probe_id::uart);
+	uart.on_transmit_complete();
+}
+#endif
+
+#if REMOTE_COMMAND
+ISR(USART_RX_vect)
+{
+	PROBE_SPAN(probe_id::uart);
+	uint8_t data;
+	if (uart.receive(data)) {
+		commands.feed(data);
+	} else {
+		commands.error();
+	}
+}
+#endif
+
+#if VERSUS
+// 受信エラーのバイトは捨てる。入力なら番号が飛ぶので、次の入力で同期が崩れたと分かる
+ISR(USART_RX_vect)
+{
+	PROBE_SPAN(probe_id::uart);
+	uint8_t data;
+	if (uart.receive(data)) {
+		versus.on_receive(data);
+	}
+}
+#endif
 
 int main()
 {
+	power_profile::instance().init();
 	io_init();
 	timer_init();
+#if USE_UART
+	uart.init();
+#endif
+#if REMOTE_COMMAND || VERSUS
+	uart.enable_receive();
+#endif
 	bar.init();
 	score_display.init();
+	brightness.init();
+	supply.init();
+	power_fail.init();
+	// ウォッチドッグのリセットなら、EEPROMを読まずに写しから値を取り、最後の状態から再開する
+	auto& warm = warm_resume::instance();
+	trace(trace_event::reset, static_cast<uint8_t>(reset_cause | (warm.valid() ? 0x80 : 0)));
+	high_score_manager::instance();
+	difficulty_manager::instance();
+	statistics_manager::instance();
+	game_manager::instance();
+#if SELF_TEST
+	if (!warm.valid()) {
+		game_manager::instance().report_self_test(self_test());
+	}
+#endif
+	// ティックの処理が止まったら(約60ms)リセットする
+	wdt_enable(WDTO_60MS);
+	// 処理はすべてタイマ割り込みの中で行うので、割り込みの合間はIdleスリープで待つ
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
 	sei();
-	while (true) {}
+	uint16_t settle_ticks = FRAME_PER_SEC;    // 約1秒動いたら、続けて再開した回数を戻す
+	while (true) {
+		sleep_cpu();
+		// UARTなどの割り込みで起きただけならリセットしない
+		if (tick_done) {
+			tick_done = false;
+			wdt_reset();
+			if (settle_ticks != 0 && --settle_ticks == 0) {
+				warm.settled();
+			}
+		}
+	}
 	return 0;
 }
 
 void io_init()
 {
-	DDRD = 0xEF;    // D4のみ入力
-	PORTD |= 0x10;    // D4をプルアップ
-	DDRB = 0xFC;    // B0, B1のみ入力
-	PORTB |= 0x03;   // B0, B1をプルアップ
-	DDRC |= 0x3F;
+	// スイッチとRXDだけ入力にしてプルアップし、残りは出力
+#if SOUND == SOUND_OC1A
+	constexpr uint8_t game_b = RELOCATED_B;
+	constexpr uint8_t game_c = RELOCATED_C;
+#else
+	constexpr uint8_t game_b = _BV(PB1);
+	constexpr uint8_t game_c = 0;
+#endif
+	constexpr uint8_t input_b = game_b | (HAS_ERASE_SWITCH ? _BV(PB0) : 0);
+	constexpr uint8_t crystal_b = BOARD_CRYSTAL ? _BV(PB6) | _BV(PB7) : 0;    // 水晶の端子はプルアップしない入力
+	constexpr uint8_t input_c = game_c;
+	constexpr uint8_t input_d = (HAS_HIGH_SCORE_SWITCH ? _BV(PD4) : 0) | (UART_PIN_REMAP ? _BV(PD0) : 0);
+	DDRD = static_cast<uint8_t>(~input_d);
+	PORTD |= input_d;
+	DDRB = static_cast<uint8_t>(~(input_b | crystal_b));
+	PORTB |= input_b;
+	DDRC = static_cast<uint8_t>((DDRC | 0x3F) & ~input_c);
+	PORTC |= input_c;
+	// アナログ入力と兼用のピン(PC0～PC5, PD6, PD7)のうち、読まない出力のデジタル入力バッファを切る。
+	// アナログ入力として使うピンはない(ADC6/ADC7にはバッファがなく、POWER_FAILの+入力はバンドギャップ)。
+	// 切ったピンのPINは常に0が読めるので、スイッチのピンは切らない。自己診断で出力を読む間は戻す
+	DIDR0 = static_cast<uint8_t>(0x3F & ~input_c);
+	DIDR1 = static_cast<uint8_t>((_BV(AIN1D) | _BV(AIN0D)) & ~(input_d >> PD6));
+}
+
+#if SELF_TEST
+/*
+  電源投入時の自己診断(self_test.h)。割り込みを許可する前に呼ぶ。
+  ランプは1つを約4ms(LAMP_STEP_TICKS)ずつ点け、その間はティックごとにスロットを切り替えて両方の桁に出す
+ */
+self_test_report self_test()
+{
+	constexpr uint8_t SLOTS = decltype(led_scan)::SLOTS;
+	constexpr uint8_t TICKS_PER_SLOT = decltype(led_scan)::TICKS_PER_SLOT;
+	constexpr uint8_t LAMP_STEP_TICKS = FRAME_PER_SEC / 250 > SLOTS ? FRAME_PER_SEC / 250 : SLOTS;
+	constexpr uint8_t LAMP_STEPS = 1 + 7 + BAR_LENGTH;    // 全消灯、7セグのA～G、バー
+	static_assert(static_cast<uint32_t>(LAMP_STEPS) * LAMP_STEP_TICKS * 1000 / FRAME_PER_SEC < 180, "the self test must finish within 200ms.");
+	// バーのLEDの番号は10個のとき(GPIOのバー)だけコードに入れる。74HC595のバーはどのLEDでもlamp_bar
+	constexpr bool BAR_INDEX_IN_CODE = BAR_LENGTH <= 10;
+	static_assert(static_cast<uint8_t>(self_test_fault::lamp_bar) + (BAR_INDEX_IN_CODE ? BAR_LENGTH - 1 : 0) < static_cast<uint8_t>(self_test_fault::game_switch),
+		"lamp_bar codes must not overlap the switch codes.");
+
+	self_test_report report;
+	timer_clock_check clock;
+	uint8_t stuck = 0x07;    // ずっと押されているスイッチ(trace_switchesと同じビット)
+	bool lamp_fault = false;
+	uint8_t slot_tick = 0;    // led_scanに渡す値。1ティックごとに次のスロットにする
+	// io_initで切ったデジタル入力バッファを戻さないと、出力を読んでも0になる
+	const uint8_t didr0 = DIDR0;
+	const uint8_t didr1 = DIDR1;
+	DIDR0 = 0;
+	DIDR1 = 0;
+
+	score_display.erase_number();
+	bar.erase();
+	TIFR0 = _BV(OCF0A);
+	clock.start();
+	for (uint8_t step = 0; step < LAMP_STEPS; ++step) {
+		if (step >= 1 && step < 8) {
+			score_display.set_pattern(static_cast<uint8_t>(_BV(step - 1)));
+		} else if (step >= 8) {
+			score_display.erase_number();
+			bar.set_position(step - 8);
+		}
+		for (uint8_t t = 0; t < LAMP_STEP_TICKS; ++t) {
+			led_scan.update(slot_tick);
+			while ((TIFR0 & _BV(OCF0A)) == 0) {
+				clock.poll();
+			}
+			TIFR0 = _BV(OCF0A);
+			clock.on_tick();
+			// 出してから1ティックたったので読める
+			if (!lamp_fault && !led_scan.verify(slot_tick)) {
+				lamp_fault = true;
+				uint8_t code = step == 0 ? static_cast<uint8_t>(self_test_fault::lamp_idle) :
+					step < 8 ? static_cast<uint8_t>(static_cast<uint8_t>(self_test_fault::lamp_segment) + step - 1) :
+					static_cast<uint8_t>(static_cast<uint8_t>(self_test_fault::lamp_bar) + (BAR_INDEX_IN_CODE ? step - 8 : 0));
+				report.push_back(static_cast<self_test_fault>(code));
+			}
+			stuck = static_cast<uint8_t>(stuck & ((game_switch.read() ? 0 : 1) | (high_score_switch.read() ? 0 : 2) | (erase_score_switch.read() ? 0 : 4)));
+			slot_tick = static_cast<uint8_t>(slot_tick + TICKS_PER_SLOT);
+		}
+	}
+	score_display.erase_number();
+	bar.erase();
+	led_scan.update(0);
+	DIDR0 = didr0;
+	DIDR1 = didr1;
+	// ランプの点検はウォッチドッグの32msより長いので、ふつうはもう測り終わっている
+	while (!clock.poll()) {
+		if ((TIFR0 & _BV(OCF0A)) != 0) {
+			TIFR0 = _BV(OCF0A);
+			clock.on_tick();
+		}
+	}
+
+	if (stuck & 1) report.push_back(self_test_fault::game_switch);
+	if (stuck & 2) report.push_back(self_test_fault::high_score_switch);
+	if (stuck & 4) report.push_back(self_test_fault::erase_switch);
+	if (!high_score_manager::instance().record_valid()) report.push_back(self_test_fault::high_score_record);
+	if (!difficulty_manager::instance().record_valid()) report.push_back(self_test_fault::difficulty_record);
+	self_test_fault timer_fault;
+	if (clock.fault(timer_fault)) report.push_back(timer_fault);
+	return report;
 }
+#endif
 
 void timer_init()
 {
-	TCCR0A = 0;
-	TCCR0B = _BV(CS01) | _BV(CS00);
-	TIMSK0 |= _BV(TOIE0);
+#if TICKLESS_PLAY
+	PCMSK0 = _BV(PCINT1);    // ゲームスイッチ(PB1)。PCICRはプレイ中だけ有効にする
+#endif
+	power_profile::instance().acquire(peripheral::timer0);
+	TCCR0A = _BV(WGM01);    // CTCモード。プリスケーラとTOPはクロック設定に合わせる
+	clock_profile::instance().init();
+	TIMSK0 |= _BV(OCIE0A);
 }
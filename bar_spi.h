@@ -0,0 +1,93 @@
+#ifndef BAR_SPI_H
+#define BAR_SPI_H
+
+/*
+  74HC595をつないだLEDバー(BAR_SPI_LENGTH != 0のとき)
+
+  配線
+    PB3(MOSI) -> SER     1個目の74HC595。2個目以降は前のQH'をSERへ
+    PB5(SCK)  -> SRCLK   全部の74HC595に共通
+    PB2(SS)   -> RCLK    全部の74HC595に共通。立ち上がりで出力が切り替わる
+    LEDは1個目のQAが0番、QHが7番、2個目のQAが8番…。今までのバーと同じく、Lowで点灯する
+
+  ハードウェアSPIをfosc/2で動かし、全バイトを続けて送ってからRCLKを立ち上げる。
+  1バイトはSPIのクロックで8クロック(CPUで16サイクル)なので、割り込みで1バイトずつ送ると
+  割り込みの出入りのほうが高くつく。SPIFを見ながら続けて送り、32個でも8MHzで約10μsで終わる。
+  SSはRCLKに使うので出力にしておく(入力のままLowになるとスレーブに切り替わってしまう)。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+
+#include "power_profile.h"
+
+template <int Length>
+class shift_register_bar
+{
+	static_assert(Length >= 8 && Length <= 32 && Length % 8 == 0, "bar length must be 8, 16, 24 or 32.");
+public:
+	static constexpr int LENGTH = Length;
+
+	void init() {
+		power_profile::instance().acquire(peripheral::spi);
+		DDRB = static_cast<uint8_t>(DDRB | _BV(PB2) | _BV(PB3) | _BV(PB5));
+		PORTB = static_cast<uint8_t>(PORTB & ~_BV(PB2));
+		SPCR = _BV(SPE) | _BV(MSTR);    // マスタ、モード0、MSBから
+		SPSR = _BV(SPI2X);    // fosc/2
+		send();
+	}
+
+	// 位置が変わらなければ転送しない
+	void set_position(int pos) {
+		if (pos < 0 || pos >= Length || pos == m_pos) return;
+		m_pos = pos;
+		send();
+	}
+
+	void erase() {
+		if (m_pos == BAR_INVALID) return;
+		m_pos = BAR_INVALID;
+		send();
+	}
+
+	// 輝度調整用。位置は覚えたまま全部消す。OEを配線していないので、全部消した内容を転送する
+	void blank() {
+		send(BAR_INVALID);
+		m_blanked = true;
+	}
+
+	// 毎ティック呼ばれるので、blankで消したときだけ転送する
+	void unblank() {
+		if (!m_blanked) return;
+		m_blanked = false;
+		send(m_pos);
+	}
+
+private:
+	static constexpr int BYTES = Length / 8;
+	static constexpr int BAR_INVALID = -1;
+
+	void send() {
+		send(m_pos);
+	}
+
+	// 遠い74HC595の分から送る。最後に送ったバイトが1個目に残る
+	void send(int pos) {
+		for (int i = BYTES - 1; i >= 0; --i) {
+			uint8_t data = 0xFF;
+			if (pos >= 0 && pos / 8 == i) {
+				data = static_cast<uint8_t>(~_BV(pos % 8));
+			}
+			SPDR = data;
+			while ((SPSR & _BV(SPIF)) == 0) {}
+		}
+		PORTB = static_cast<uint8_t>(PORTB | _BV(PB2));
+		PORTB = static_cast<uint8_t>(PORTB & ~_BV(PB2));
+	}
+
+	int m_pos = BAR_INVALID;
+	bool m_blanked = false;    // blankで消したまま
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef BAR_TIMER_H
+#define BAR_TIMER_H
+
+/*
+  プレイ中のバーの移動を決めるタイマ(TICKLESS_PLAY = 1のとき)
+
+  Timer1をノーマルモードでTimer0と同じTIMER_HZ(8MHzなら1/64で125kHz、8μs単位)で回し、
+  OCR1Aに次の1歩の期限を書く。
+  コンペアマッチ割り込みでOCR1Aに間隔を足していくので、割り込みの遅れがたまらない。
+  Timer0のティックと同じクロックなので、1ティックはTICK_COUNTSカウント。
+  プレイ中は必ず全速のクロックなので、プリスケーラは切り替えない。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+
+#include "config.h"
+#include "power_profile.h"
+#include "clock_profile.h"
+
+#if TICKLESS_PLAY
+
+class bar_step_timer
+{
+public:
+	static constexpr uint16_t COUNTS_PER_TICK = TICK_COUNTS;
+
+	void start(uint16_t interval) {
+		power_profile::instance().acquire(peripheral::timer1);
+		TCCR1A = 0;
+		TCCR1B = board_clock::TIMER1_CS;
+		restart(interval);
+		TIFR1 = _BV(OCF1A);
+		TIMSK1 = _BV(OCIE1A);
+	}
+
+	// 今からintervalカウント後を次の期限にする
+	void restart(uint16_t interval) {
+		m_interval = interval;
+		OCR1A = static_cast<uint16_t>(TCNT1 + interval);
+	}
+
+	// TIMER1_COMPA_vectから呼ぶ。前の期限からintervalカウント後を次の期限にする
+	void advance() {
+		OCR1A = static_cast<uint16_t>(OCR1A + m_interval);
+	}
+
+	void stop() {
+		TIMSK1 = 0;
+		TCCR1B = 0;
+		power_profile::instance().release(peripheral::timer1);
+	}
+
+	uint16_t interval() const {
+		return m_interval;
+	}
+
+	// 前の期限からのカウント数
+	uint16_t elapsed() const {
+		return static_cast<uint16_t>(TCNT1 - (OCR1A - m_interval));
+	}
+
+private:
+	uint16_t m_interval = 0;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,62 @@
+/*
+  containers_avr: containers.hの実体化ごとのコードの大きさをAVRで測る(make avr-size)
+
+  ホストでは動かさない。よく使う形の実体化の操作を1つずつnoinlineの関数にして
+  -ffunction-sectionsでコンパイルし、avr-nm --size-sortで関数ごとの大きさを並べる。
+  関数の名前が「コンテナ_型_容量_操作」になっている。
+ */
+
+#include <stdint.h>
+
+#include "containers.h"
+
+#define PROBE_FUNC extern "C" __attribute__((noinline, used))
+
+namespace
+{
+	ring_buffer<uint8_t, 64> ring_u8;
+	ring_buffer<uint16_t, 16> ring_u16;
+	static_vector<uint8_t, 16> vector_u8;
+	static_vector<uint16_t, 32> vector_u16;
+	bitset<64> bits_64;
+	bitset<256> bits_256;
+	bitset<256, uint16_t> bits_256_w16;
+
+	const flash_table<uint8_t, 16> table_u8 PROGMEM {{8, 9, 11, 15, 21, 30, 41, 54, 70, 88, 109, 133, 159, 188, 220, 255}};
+	const flash_table<uint16_t, 4> table_u16 PROGMEM {{1000, 2000, 4000, 8000}};
+	struct triple
+	{
+		uint8_t a, b, c;
+	};
+	const flash_table<triple, 4> table_triple PROGMEM {{{1, 2, 3}, {4, 5, 6}, {7, 8, 9}, {10, 11, 12}}};
+}
+
+PROBE_FUNC bool ring_u8_64_push(uint8_t value) { return ring_u8.push(value); }
+PROBE_FUNC bool ring_u8_64_pop(uint8_t& value) { return ring_u8.pop(value); }
+PROBE_FUNC uint8_t ring_u8_64_size() { return ring_u8.size(); }
+PROBE_FUNC bool ring_u16_16_push(uint16_t value) { return ring_u16.push(value); }
+PROBE_FUNC bool ring_u16_16_pop(uint16_t& value) { return ring_u16.pop(value); }
+
+PROBE_FUNC bool vector_u8_16_push_back(uint8_t value) { return vector_u8.push_back(value); }
+PROBE_FUNC void vector_u8_16_erase(uint8_t i) { vector_u8.erase(i); }
+PROBE_FUNC void vector_u8_16_erase_unordered(uint8_t i) { vector_u8.erase_unordered(i); }
+PROBE_FUNC bool vector_u16_32_push_back(uint16_t value) { return vector_u16.push_back(value); }
+PROBE_FUNC void vector_u16_32_erase(uint8_t i) { vector_u16.erase(i); }
+
+PROBE_FUNC void bitset_64_set(uint16_t i) { bits_64.set(i); }
+PROBE_FUNC bool bitset_64_test(uint16_t i) { return bits_64.test(i); }
+PROBE_FUNC uint16_t bitset_64_count() { return bits_64.count(); }
+PROBE_FUNC uint16_t bitset_256_find_next(uint16_t i) { return bits_256.find_next(i); }
+PROBE_FUNC uint16_t bitset_256_count() { return bits_256.count(); }
+PROBE_FUNC void bitset_256_or(const bitset<256>& other) { bits_256 |= other; }
+PROBE_FUNC uint16_t bitset_256_w16_find_next(uint16_t i) { return bits_256_w16.find_next(i); }
+PROBE_FUNC uint16_t bitset_256_w16_count() { return bits_256_w16.count(); }
+
+PROBE_FUNC uint8_t table_u8_16_read(uint8_t i) { return table_u8[i]; }
+PROBE_FUNC uint16_t table_u16_4_read(uint8_t i) { return table_u16[i]; }
+PROBE_FUNC uint8_t table_triple_4_read(uint8_t i) { return table_triple[i].b; }
+
+int main()
+{
+	return 0;
+}
@@ -0,0 +1,227 @@
+/*
+  containers_bench: containers.hのコンテナの1操作あたりの処理時間を、手書きの同等品と比べる
+
+    ring_buffer     今までのuart.hと同じ「添字をマスクで回し、1個空けて満杯を判定する」リング
+    static_vector   配列と個数を別々に持つ書き方
+    bitset          boolの配列。bitsetはWordがuint8_t(AVRと同じ)とuint32_tの両方を測る
+    flash_table     ただの配列(ホストではどちらも同じ読み方になるはず)
+
+  どれも同じ入力で同じ結果(チェックサム)になることを確かめ、違えば終了コード1で終わる。
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+
+#include "containers.h"
+
+namespace
+{
+	constexpr long ROUNDS = 2000000;
+
+	uint32_t next_random(uint32_t& seed)
+	{
+		seed = seed * 1103515245 + 12345;
+		return seed >> 16;
+	}
+
+	// fを1回実行し、operationsで割った1操作あたりの時間を返す(operationsはfが数える)
+	template <class F>
+	double measure(const long& operations, F f)
+	{
+		auto start = std::chrono::steady_clock::now();
+		f();
+		double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return sec * 1e9 / static_cast<double>(operations);
+	}
+
+	bool report(const char* name, double ns, const char* baseline, double baseline_ns, uint64_t sum, uint64_t baseline_sum)
+	{
+		printf("%-26s %8.2f ns/op   %-22s %8.2f ns/op\n", name, ns, baseline, baseline_ns);
+		if (sum != baseline_sum) {
+			fprintf(stderr, "%s: checksum mismatch %llu, %s %llu\n", name,
+				static_cast<unsigned long long>(sum), baseline, static_cast<unsigned long long>(baseline_sum));
+			return false;
+		}
+		return true;
+	}
+
+	// uart.hと同じ形のリング
+	class masked_ring
+	{
+	public:
+		bool push(uint8_t value) {
+			uint8_t next = static_cast<uint8_t>((m_head + 1) & MASK);
+			if (next == m_tail) return false;
+			m_elem[m_head] = value;
+			m_head = next;
+			return true;
+		}
+
+		bool pop(uint8_t& value) {
+			if (m_head == m_tail) return false;
+			value = m_elem[m_tail];
+			m_tail = static_cast<uint8_t>((m_tail + 1) & MASK);
+			return true;
+		}
+
+	private:
+		static constexpr uint8_t MASK = 63;
+		uint8_t m_elem[64];
+		uint8_t m_head = 0;
+		uint8_t m_tail = 0;
+	};
+
+	// 書いては読むのを、1回に1～32個ずつ繰り返す
+	template <class Ring>
+	uint64_t ring_workload(long& operations)
+	{
+		Ring ring;
+		uint32_t seed = 1;
+		uint64_t sum = 0;
+		operations = 0;
+		for (long r = 0; r < ROUNDS; ++r) {
+			uint8_t count = static_cast<uint8_t>(next_random(seed) % 32 + 1);
+			for (uint8_t i = 0; i < count; ++i) {
+				ring.push(static_cast<uint8_t>(r + i));
+			}
+			uint8_t value;
+			while (ring.pop(value)) {
+				sum += value;
+			}
+			operations += count * 2;
+		}
+		return sum;
+	}
+
+	// 32個まで積み、合計し、ところどころ消す
+	uint64_t vector_workload(long& operations)
+	{
+		static_vector<uint16_t, 32> v;
+		uint32_t seed = 1;
+		uint64_t sum = 0;
+		operations = 0;
+		for (long r = 0; r < ROUNDS; ++r) {
+			v.clear();
+			while (!v.full()) {
+				v.push_back(static_cast<uint16_t>(next_random(seed)));
+			}
+			v.erase_unordered(static_cast<uint8_t>(r % 32));
+			for (uint16_t x : v) sum += x;
+			operations += 32 + 1 + 31;
+		}
+		return sum;
+	}
+
+	uint64_t raw_vector_workload(long& operations)
+	{
+		uint16_t v[32];
+		uint8_t size;
+		uint32_t seed = 1;
+		uint64_t sum = 0;
+		operations = 0;
+		for (long r = 0; r < ROUNDS; ++r) {
+			size = 0;
+			while (size < 32) {
+				v[size++] = static_cast<uint16_t>(next_random(seed));
+			}
+			v[r % 32] = v[--size];
+			for (uint8_t i = 0; i < size; ++i) sum += v[i];
+			operations += 32 + 1 + 31;
+		}
+		return sum;
+	}
+
+	// 256ビットのうち数個を立て替え、数えて、立っているビットを順にたどる
+	template <class Set>
+	uint64_t bitset_workload(long& operations)
+	{
+		Set s;
+		uint32_t seed = 1;
+		uint64_t sum = 0;
+		operations = 0;
+		for (long r = 0; r < ROUNDS / 4; ++r) {
+			for (int i = 0; i < 4; ++i) {
+				uint16_t bit = static_cast<uint16_t>(next_random(seed) % 256);
+				s.assign(bit, (next_random(seed) & 3) != 0 && s.count() < 24);
+			}
+			sum += s.count();
+			for (uint16_t i = s.find_first(); i < 256; i = s.find_next(static_cast<uint16_t>(i + 1))) {
+				sum += i;
+			}
+			operations += 4 + 1 + 1;
+		}
+		return sum;
+	}
+
+	class bool_array
+	{
+	public:
+		void assign(uint16_t i, bool value) {
+			m_bits[i] = value;
+		}
+
+		uint16_t count() const {
+			uint16_t n = 0;
+			for (bool b : m_bits) n = static_cast<uint16_t>(n + b);
+			return n;
+		}
+
+		uint16_t find_next(uint16_t i) const {
+			while (i < 256 && !m_bits[i]) ++i;
+			return i;
+		}
+
+		uint16_t find_first() const {
+			return find_next(0);
+		}
+
+	private:
+		bool m_bits[256] = {};
+	};
+
+	const flash_table<uint8_t, 16> flash_duty {{8, 9, 11, 15, 21, 30, 41, 54, 70, 88, 109, 133, 159, 188, 220, 255}};
+	const uint8_t plain_duty[16] {8, 9, 11, 15, 21, 30, 41, 54, 70, 88, 109, 133, 159, 188, 220, 255};
+
+	template <class Table>
+	uint64_t table_workload(const Table& table, long& operations)
+	{
+		uint32_t seed = 1;
+		uint64_t sum = 0;
+		operations = ROUNDS * 8;
+		for (long r = 0; r < operations; ++r) {
+			sum += table[static_cast<uint8_t>(next_random(seed) & 15)];
+		}
+		return sum;
+	}
+}
+
+int main()
+{
+	bool ok = true;
+	long operations = 0;
+	uint64_t sum = 0, baseline_sum = 0;
+	double ns, baseline_ns;
+
+	ns = measure(operations, [&] { sum = ring_workload<ring_buffer<uint8_t, 64>>(operations); });
+	baseline_ns = measure(operations, [&] { baseline_sum = ring_workload<masked_ring>(operations); });
+	ok &= report("ring_buffer<uint8_t, 64>", ns, "masked ring (uart.h)", baseline_ns, sum, baseline_sum);
+
+	ns = measure(operations, [&] { sum = vector_workload(operations); });
+	baseline_ns = measure(operations, [&] { baseline_sum = raw_vector_workload(operations); });
+	ok &= report("static_vector<uint16_t, 32>", ns, "array + size", baseline_ns, sum, baseline_sum);
+
+	ns = measure(operations, [&] { sum = bitset_workload<bitset<256>>(operations); });
+	baseline_ns = measure(operations, [&] { baseline_sum = bitset_workload<bool_array>(operations); });
+	ok &= report("bitset<256, uint8_t>", ns, "bool[256]", baseline_ns, sum, baseline_sum);
+
+	ns = measure(operations, [&] { sum = bitset_workload<bitset<256, uint32_t>>(operations); });
+	ok &= report("bitset<256, uint32_t>", ns, "bool[256]", baseline_ns, sum, baseline_sum);
+
+	ns = measure(operations, [&] { sum = table_workload(flash_duty, operations); });
+	baseline_ns = measure(operations, [&] { baseline_sum = table_workload(plain_duty, operations); });
+	ok &= report("flash_table<uint8_t, 16>", ns, "uint8_t[16]", baseline_ns, sum, baseline_sum);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+/*
+  timer_wheel_bench: timer_wheelの1ティックあたりの処理時間を、動いているタイマの数ごとに測る
+
+  比較のために、今までのgame_managerと同じく「タイマごとにカウンタを毎ティック減らして比べる」
+  方式(counter_scan)も同じ条件で測る。タイマの周期はゲームで使う値に近い25～1500ティック。
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+
+#include "timer_wheel.h"
+
+namespace
+{
+	constexpr uint8_t CAPACITY = 8;
+	constexpr uint16_t PERIODS[CAPACITY] = {25, 50, 250, 1500, 9, 13, 100, 30000};
+	constexpr long TICKS = 20000000;
+
+	// 比べる相手。タイマごとのカウンタを毎ティック全部見る
+	class counter_scan
+	{
+	public:
+		void start(uint8_t n) {
+			for (uint8_t i = 0; i < n; ++i) {
+				m_count[i] = PERIODS[i];
+			}
+			m_active = n;
+		}
+
+		void advance() {
+			for (uint8_t i = 0; i < m_active; ++i) {
+				if (--m_count[i] == 0) {
+					m_count[i] = PERIODS[i];
+					++fired;
+				}
+			}
+		}
+
+		uint64_t fired = 0;
+
+	private:
+		uint16_t m_count[CAPACITY];
+		uint8_t m_active = 0;
+	};
+
+	class wheel_owner
+	{
+	public:
+		void start(uint8_t n) {
+			for (uint8_t i = 0; i < n; ++i) {
+				m_timers.schedule(i, PERIODS[i], &wheel_owner::on_timer, PERIODS[i]);
+			}
+		}
+
+		void advance() {
+			m_timers.advance(*this);
+		}
+
+		uint64_t fired = 0;
+
+	private:
+		void on_timer() {
+			++fired;
+		}
+
+		timer_wheel<wheel_owner, 16, CAPACITY> m_timers;
+	};
+
+	template <class T>
+	double measure(uint8_t n, uint64_t& fired)
+	{
+		T t;
+		t.start(n);
+		auto start = std::chrono::steady_clock::now();
+		for (long i = 0; i < TICKS; ++i) {
+			t.advance();
+		}
+		double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fired = t.fired;
+		return sec * 1e9 / TICKS;
+	}
+}
+
+int main()
+{
+	printf("timers  wheel ns/tick  counter_scan ns/tick  callbacks\n");
+	for (uint8_t n = 0; n <= CAPACITY; ++n) {
+		uint64_t wheel_fired, scan_fired;
+		double wheel = measure<wheel_owner>(n, wheel_fired);
+		double scan = measure<counter_scan>(n, scan_fired);
+		printf("%6u  %13.2f  %20.2f  %9llu\n", n, wheel, scan, static_cast<unsigned long long>(wheel_fired));
+		if (wheel_fired != scan_fired) {
+			fprintf(stderr, "callback count mismatch: wheel %llu, counter_scan %llu\n",
+				static_cast<unsigned long long>(wheel_fired), static_cast<unsigned long long>(scan_fired));
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,61 @@
+###############################################################################
+# ボードの選択。Makefileとbootloader/Makefileから読む
+#
+#   MCU   = atmega88 | atmega168 | atmega328p (88p, 168pも可。ピン配置はすべて同じ)
+#   CLOCK = rc8    内蔵RC 8MHz
+#           xtal16 水晶 16MHz (BAR_SPI_LENGTHが必要。board_profile.hを参照)
+#           xtal20 水晶 20MHz (同上。VCCは4.5V以上)
+#
+# 例: make MCU=atmega328p CLOCK=xtal16 BAR_SPI_LENGTH=16
+# F_CPU、ヒューズ、ブートローダの開始アドレスはここで決める。変えたらmake cleanすること
+###############################################################################
+
+MCU ?= atmega88
+CLOCK ?= rc8
+BOOTLOADER ?= 0
+
+## Clock: F_CPU and LFUSE (CKSEL, SUT, CKDIV8)
+## rc8: 内蔵RC, 6CK + 64ms. xtal: フルスイングの水晶, 16K CK + 65ms
+ifeq ($(CLOCK),rc8)
+F_CPU = 8000000
+LFUSE = 0xe2
+else ifeq ($(CLOCK),xtal16)
+F_CPU = 16000000
+LFUSE = 0xf7
+else ifeq ($(CLOCK),xtal20)
+F_CPU = 20000000
+LFUSE = 0xf7
+else
+$(error CLOCK must be rc8, xtal16 or xtal20)
+endif
+
+## BOD: 水晶では4.3V(16MHz以上はVCC 4.5Vが必要)、ブートローダでは自己書き込みを守るため2.7V
+## BODLEVEL 7: なし, 5: 2.7V, 4: 4.3V
+ifneq ($(CLOCK),rc8)
+BODLEVEL = 4
+else ifeq ($(BOOTLOADER),1)
+BODLEVEL = 5
+else
+BODLEVEL = 7
+endif
+
+## Boot section: 1KB at the end of flash with BOOTRST (BOOTLOADER = 1, see bootloader/)
+## ATmega88/168: BOOTSZ, BOOTRSTはEFUSE、BODLEVELはHFUSE
+## ATmega328P:   BOOTSZ, BOOTRSTはHFUSE、BODLEVELはEFUSE
+ifneq ($(filter atmega88 atmega88p,$(MCU)),)
+BOOT_START = 0x1C00
+else ifneq ($(filter atmega168 atmega168p,$(MCU)),)
+BOOT_START = 0x3C00
+else ifeq ($(MCU),atmega328p)
+BOOT_START = 0x7C00
+else
+$(error MCU must be atmega88, atmega168 or atmega328p)
+endif
+
+ifeq ($(MCU),atmega328p)
+HFUSE = $(if $(filter 1,$(BOOTLOADER)),0xdc,0xdf)
+EFUSE = $(word $(BODLEVEL),0xf9 0xfa 0xfb 0xfc 0xfd 0xfe 0xff)
+else
+HFUSE = $(word $(BODLEVEL),0xd9 0xda 0xdb 0xdc 0xdd 0xde 0xdf)
+EFUSE = $(if $(filter 1,$(BOOTLOADER)),0xfa,0xff)
+endif
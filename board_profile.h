@@ -0,0 +1,95 @@
+#ifndef BOARD_PROFILE_H
+#define BOARD_PROFILE_H
+
+/*
+  ボードとMCUのプロファイル
+
+  MCUとクロックはboard.mkで選び、-mmcuと-DF_CPUで渡される。ここではそれに合わせて
+  タイマ、ADC、クロック切り替えの設定と、ピン配置の違いをコンパイル時に決める。
+  値はすべて定数なので、実行時のコードは今までと同じになる。
+
+  MCU
+    ATmega88/168/328Pはピン配置と周辺機能のレジスタが同じで、違うのはフラッシュ、RAM、EEPROMの
+    大きさとヒューズの並びだけ。ファームウェアのコードはどれでも同じ。
+  クロック
+    8MHz(内蔵RC): Timer0とTimer1は1/64で125kHz。待機中は1/8(1MHz)に落とし、タイマは1/8
+    16MHz、20MHz(水晶): タイマは1/256で62.5kHz、78.125kHz。待機中は1/32に落とし、タイマは1/8
+    どのクロックでも、BASE_TICK_COUNTS(clock_profile.h)カウントが約2.048msになる。
+    水晶はPB6/PB7(XTAL1/XTAL2)を使うので、7セグのカソードをPC1/PC2に移す。
+    そのためBAR_SPI_LENGTH(74HC595のバー)が必要。
+    20MHzはVCCが4.5V以上必要(board.mkでBODを4.3Vにしている)。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/power.h>
+
+#include "config.h"
+
+#if !defined(__AVR_ATmega88__) && !defined(__AVR_ATmega88P__) && !defined(__AVR_ATmega168__) && !defined(__AVR_ATmega168P__) && !defined(__AVR_ATmega328P__)
+#error "MCU must be ATmega88(P), ATmega168(P) or ATmega328P"
+#endif
+
+// 水晶で動かすか。ピン配置を変えるのでプリプロセッサでも使う
+#define BOARD_CRYSTAL (F_CPU != 8000000UL)
+
+#if BOARD_CRYSTAL && !BAR_SPI_LENGTH
+#error "crystal clock uses PB6/PB7 and moves the digit cathodes to PC1/PC2, which requires BAR_SPI_LENGTH"
+#endif
+
+// 内蔵RCの8MHz
+struct rc_8mhz_clock
+{
+	static constexpr bool CRYSTAL = false;
+	static constexpr uint16_t TIMER_PRESCALER = 64;
+	static constexpr uint8_t TIMER0_CS = _BV(CS01) | _BV(CS00);
+	static constexpr uint8_t TIMER1_CS = _BV(CS11) | _BV(CS10);
+	static constexpr uint8_t ADC_PS = _BV(ADPS2) | _BV(ADPS1);    // 1/64
+	// 待機中
+	static constexpr clock_div_t IDLE_DIV = clock_div_8;
+	static constexpr uint8_t IDLE_TIMER0_CS = _BV(CS01);
+	static constexpr uint8_t IDLE_ADC_PS = _BV(ADPS1) | _BV(ADPS0);    // 1/8
+	// 効果音(Timer2)
+	static constexpr uint16_t TONE2_PRESCALER = 32;
+	static constexpr uint8_t TONE2_CS = _BV(CS21) | _BV(CS20);
+};
+
+// 16MHz、20MHzの水晶
+struct crystal_clock
+{
+	static constexpr bool CRYSTAL = true;
+	static constexpr uint16_t TIMER_PRESCALER = 256;
+	static constexpr uint8_t TIMER0_CS = _BV(CS02);
+	static constexpr uint8_t TIMER1_CS = _BV(CS12);
+	static constexpr uint8_t ADC_PS = _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);    // 1/128
+	static constexpr clock_div_t IDLE_DIV = clock_div_32;
+	static constexpr uint8_t IDLE_TIMER0_CS = _BV(CS01);
+	static constexpr uint8_t IDLE_ADC_PS = _BV(ADPS1);    // 1/4
+	static constexpr uint16_t TONE2_PRESCALER = 128;
+	static constexpr uint8_t TONE2_CS = _BV(CS22) | _BV(CS20);
+};
+
+// F_CPUごとの設定。ここにないクロックはコンパイルエラーになる
+template <uint32_t CpuHz>
+struct clock_traits;
+
+template <>
+struct clock_traits<8000000UL> : rc_8mhz_clock {};
+
+template <>
+struct clock_traits<16000000UL> : crystal_clock {};
+
+template <>
+struct clock_traits<20000000UL> : crystal_clock {};
+
+using board_clock = clock_traits<F_CPU>;
+
+static_assert(board_clock::CRYSTAL == BOARD_CRYSTAL, "BOARD_CRYSTAL does not match the clock traits.");
+static_assert(board_clock::TIMER_PRESCALER == (1u << static_cast<uint8_t>(board_clock::IDLE_DIV)) * 8,
+	"the idle clock must keep the timer clock unchanged.");
+
+// Timer0、Timer1に入るクロック(全速でも待機中でも同じ)
+constexpr uint32_t TIMER_HZ = F_CPU / board_clock::TIMER_PRESCALER;
+
+#endif
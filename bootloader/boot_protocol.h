@@ -0,0 +1,44 @@
+#ifndef BOOT_PROTOCOL_H
+#define BOOT_PROTOCOL_H
+
+/*
+  ブートローダとホスト側のアップローダ(tools/hokey-upload)の間の手順
+
+  ホストからのコマンドは1バイト。応答は必ずOKかERRORで終わる
+    SYNC   応答: INFO, シグネチャ3バイト, ページサイズ, アプリ領域のページ数, OK
+    CRC    応答: アプリ領域の全ページのCRC(ページ順、各2バイト・リトルエンディアン), OK
+    WRITE  続けてページ番号1バイト、データ1ページ分、データのCRC2バイトを送る
+           応答: 書き込んで読み直したCRCが一致すればOK、そうでなければERROR
+    EXIT   応答: OK。その後アプリを起動する
+
+  CRCはCRC-16/XMODEM(多項式0x1021、初期値0)。
+  先頭ページが消去されている(先頭ワードが0xFFFF)間はアプリを起動しない。
+  途中で電源が切れてもブートローダに留まるように、ホストは最初に先頭ページを消去し、
+  最後に書き込む。
+ */
+
+#include <stdint.h>
+
+namespace boot_protocol
+{
+	constexpr uint8_t SYNC = 'S';
+	constexpr uint8_t CRC = 'C';
+	constexpr uint8_t WRITE = 'W';
+	constexpr uint8_t EXIT = 'X';
+
+	constexpr uint8_t INFO = 'H';
+	constexpr uint8_t OK = 'K';
+	constexpr uint8_t ERROR = 'E';
+
+	constexpr uint32_t BAUD = 38400;
+
+	inline uint16_t crc_update(uint16_t crc, uint8_t data) {
+		crc = static_cast<uint16_t>(crc ^ (data << 8));
+		for (int i = 0; i < 8; ++i) {
+			crc = (crc & 0x8000) != 0 ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+		}
+		return crc;
+	}
+}
+
+#endif
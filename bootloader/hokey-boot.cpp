@@ -0,0 +1,176 @@
+/*
+  avr-hokey用のシリアルブートローダ
+
+  ブートセクション(フラッシュの最後の1KB。BOOT_STARTはboard.mk)に置き、BOOTRSTでリセット時にここから起動する。
+  UART(PD0/PD1)を使うので、UART_PIN_REMAP = 1の基板が前提。
+
+  ・外部リセット(RESETピン)のときだけ、250msの間ホストからのSYNCを待つ
+    電源投入やウォッチドッグによるリセットでは待たずにアプリを起動する
+  ・アプリ領域の先頭ページが消去されていればアプリを起動せずに待ち続ける
+  ・ページごとのCRCをホストに返し、ホストは変わったページだけを送ってくる
+
+  手順の詳細はboot_protocol.hを参照。
+  MCUSRはアプリがリセット要因を調べられるように消さずに残す。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/boot.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include <util/delay.h>
+
+#include "boot_protocol.h"
+
+namespace
+{
+	constexpr uint8_t PAGE_COUNT = BOOT_START / SPM_PAGESIZE;
+	constexpr uint16_t SYNC_WAIT_MS = 250;
+
+	uint8_t page_buffer[SPM_PAGESIZE];
+
+	void uart_init()
+	{
+		UBRR0 = static_cast<uint16_t>((F_CPU + boot_protocol::BAUD * 4) / (boot_protocol::BAUD * 8) - 1);
+		UCSR0A = _BV(U2X0);
+		UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+		UCSR0B = _BV(RXEN0) | _BV(TXEN0);
+	}
+
+	bool received()
+	{
+		return (UCSR0A & _BV(RXC0)) != 0;
+	}
+
+	uint8_t get()
+	{
+		while (!received()) {}
+		return UDR0;
+	}
+
+	void put(uint8_t c)
+	{
+		while ((UCSR0A & _BV(UDRE0)) == 0) {}
+		UDR0 = c;
+	}
+
+	void put_word(uint16_t w)
+	{
+		put(static_cast<uint8_t>(w));
+		put(static_cast<uint8_t>(w >> 8));
+	}
+
+	// _crc_xmodem_updateはboot_protocol::crc_updateと同じ計算
+	uint16_t flash_crc(uint16_t address)
+	{
+		uint16_t crc = 0;
+		for (uint8_t i = 0; i < SPM_PAGESIZE; ++i) {
+			crc = _crc_xmodem_update(crc, pgm_read_byte(address + i));
+		}
+		return crc;
+	}
+
+	void write_page(uint16_t address)
+	{
+		boot_page_erase(address);
+		boot_spm_busy_wait();
+		for (uint8_t i = 0; i < SPM_PAGESIZE; i += 2) {
+			boot_page_fill(address + i, static_cast<uint16_t>(page_buffer[i] | (page_buffer[i + 1] << 8)));
+		}
+		boot_page_write(address);
+		boot_spm_busy_wait();
+		boot_rww_enable();
+	}
+
+	bool app_present()
+	{
+		return pgm_read_word(0) != 0xFFFF;
+	}
+
+	void start_app()
+	{
+		UCSR0B = 0;
+		UCSR0A = 0;
+		UBRR0 = 0;
+		reinterpret_cast<void (*)()>(0)();
+	}
+
+	bool wait_sync()
+	{
+		for (uint16_t t = 0; t < SYNC_WAIT_MS * 10; ++t) {
+			if (received() && UDR0 == boot_protocol::SYNC) return true;
+			_delay_us(100);
+		}
+		return false;
+	}
+
+	void command(uint8_t c)
+	{
+		switch (c) {
+		case boot_protocol::SYNC:
+			put(boot_protocol::INFO);
+			put(SIGNATURE_0);
+			put(SIGNATURE_1);
+			put(SIGNATURE_2);
+			put(SPM_PAGESIZE);
+			put(PAGE_COUNT);
+			break;
+		case boot_protocol::CRC:
+			for (uint16_t address = 0; address < BOOT_START; address += SPM_PAGESIZE) {
+				put_word(flash_crc(address));
+			}
+			break;
+		case boot_protocol::WRITE: {
+			uint8_t page = get();
+			uint16_t crc = 0;
+			for (uint8_t i = 0; i < SPM_PAGESIZE; ++i) {
+				page_buffer[i] = get();
+				crc = _crc_xmodem_update(crc, page_buffer[i]);
+			}
+			uint16_t expected = get();
+			expected = static_cast<uint16_t>(expected | (get() << 8));
+			uint16_t address = static_cast<uint16_t>(page * SPM_PAGESIZE);
+			if (page >= PAGE_COUNT || crc != expected) {
+				put(boot_protocol::ERROR);
+				return;
+			}
+			write_page(address);
+			if (flash_crc(address) != expected) {
+				put(boot_protocol::ERROR);
+				return;
+			}
+			break;
+		}
+		case boot_protocol::EXIT:
+			UCSR0A = static_cast<uint8_t>(UCSR0A | _BV(TXC0));
+			put(boot_protocol::OK);
+			while ((UCSR0A & _BV(TXC0)) == 0) {}
+			start_app();
+			return;
+		default:
+			put(boot_protocol::ERROR);
+			return;
+		}
+		put(boot_protocol::OK);
+	}
+}
+
+int main()
+{
+	bool external_reset = (MCUSR & _BV(EXTRF)) != 0;
+	if (!external_reset && app_present()) {
+		start_app();
+	}
+	uart_init();
+	if (app_present()) {
+		if (!wait_sync()) {
+			start_app();
+		}
+		command(boot_protocol::SYNC);
+	}
+	while (true) {
+		command(get());
+	}
+	return 0;
+}
@@ -0,0 +1,128 @@
+#ifndef BRIGHTNESS_H
+#define BRIGHTNESS_H
+
+/*
+  表示の輝度調整(AMBIENT_LIGHTかSUPPLY_MONITORのとき)
+
+  AMBIENT_LIGHTにADCのチャンネルを指定すると、周囲の明るさに合わせる。
+  SUPPLY_MONITORのときは、電源電圧が低い間は明るさの上限を下げて電池を持たせる。
+
+  光センサ(CdSなど)をVCC側、抵抗をGND側にした分圧をADC6かADC7(TQFPのみ)につなぐ。
+  明るいほど電圧が高くなる。
+
+  光センサは速く変わらないので、約32ms(FAST_TICKでないときの16ティック)ごとに1回だけ変換する。
+  ティックの処理でADSCを立てて変換を始め、ADC割り込みでは指数移動平均を1回計算するだけ
+  (平均の時定数は約0.5秒)。ADCの自動トリガ(フリーランやTimer0)はティックごと以上に変換して
+  割り込みが増えるので使わない。
+  ティックごとに、平均値から16段階の明るさを決め、ガンマ補正したデューティに
+  1ティックあたり1ずつ近づける(いちばん暗いところから明るいところまで約0.5秒、FAST_TICKでは約0.13秒)。
+
+  デューティ(/256)を1ティックのカウント数に換算してOCR0Bに設定する。ティックの頭(コンペアマッチA)で点灯し、
+  TCNT0がOCR0Bになったところ(コンペアマッチB)で7セグとバーを消す。
+  最大のときはコンペアマッチBの割り込みを止めるので、消灯の処理もなくなる。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "config.h"
+#include "containers.h"
+#include "power_profile.h"
+#include "clock_profile.h"
+
+#if USE_DIMMING
+
+class display_brightness
+{
+public:
+	void init() {
+#if AMBIENT_LIGHT
+		power_profile::instance().acquire(peripheral::adc);
+		ADMUX = _BV(REFS0) | AMBIENT_LIGHT;    // AVCC基準
+		ADCSRB = 0;
+		ADCSRA = static_cast<uint8_t>(_BV(ADEN) | _BV(ADIE) | clock_profile::instance().adc_prescaler());
+#endif
+		OCR0B = compare_for(MAX_DUTY);
+	}
+
+	// ADC_vectから呼ぶ。filtered = filtered + (sample - filtered) / 16。値は16倍で持つ
+	void on_conversion(uint16_t sample) {
+#if AMBIENT_LIGHT
+		int16_t diff = static_cast<int16_t>((sample << 4) - m_filtered);
+		m_filtered = static_cast<uint16_t>(m_filtered + (diff >> 4));
+#else
+		(void)sample;
+#endif
+	}
+
+	// タイマ割り込みから毎ティック呼ぶ。low_supplyなら電源電圧が低いので暗くする
+	void update(bool low_supply) {
+#if AMBIENT_LIGHT
+		if (--m_sample_countdown == 0) {
+			m_sample_countdown = SAMPLE_TICKS;
+			// ADIFに1を書くと、まだ呼ばれていない変換終了の割り込みが消えるので0で書く
+			ADCSRA = static_cast<uint8_t>((ADCSRA & ~_BV(ADIF)) | _BV(ADSC));
+		}
+		uint8_t level = static_cast<uint8_t>(m_filtered >> 10);    // 16倍した10ビットの上位4ビット
+		uint8_t target = duty_table[level];
+#else
+		uint8_t target = MAX_DUTY;
+#endif
+		if (low_supply && target > LOW_SUPPLY_DUTY) target = LOW_SUPPLY_DUTY;
+		if (m_duty == target) return;
+		m_duty = m_duty < target ? static_cast<uint8_t>(m_duty + 1) : static_cast<uint8_t>(m_duty - 1);
+		OCR0B = compare_for(m_duty);
+		if (m_duty == MAX_DUTY) {
+			TIMSK0 = static_cast<uint8_t>(TIMSK0 & ~_BV(OCIE0B));
+		} else {
+			TIMSK0 = static_cast<uint8_t>(TIMSK0 | _BV(OCIE0B));
+		}
+	}
+
+	uint8_t duty() const {
+		return m_duty;
+	}
+
+private:
+	static constexpr uint8_t MAX_DUTY = 255;
+	static constexpr uint8_t LOW_SUPPLY_DUTY = 54;    // 電源電圧が低いときの上限(約21%)
+
+	static uint8_t compare_for(uint8_t duty) {
+		return static_cast<uint8_t>(static_cast<uint16_t>(duty * TICK_COUNTS) >> 8);
+	}
+
+#if AMBIENT_LIGHT
+	// 約32ms(FAST_TICKでないときの16ティック)
+	static constexpr uint8_t SAMPLE_TICKS = static_cast<uint8_t>(16UL * BASE_TICK_COUNTS / TICK_COUNTS);
+
+	// 明るさ16段階のデューティ(/256)。8 + 247 * (i / 15)^2.2。暗くても読めるように下限は約3%
+	static const flash_table<uint8_t, 16> duty_table;
+
+	uint16_t m_filtered = 1023u << 4;
+	uint8_t m_sample_countdown = 1;    // 最初のティックで測り始める
+#endif
+	uint8_t m_duty = MAX_DUTY;
+};
+
+#if AMBIENT_LIGHT
+const flash_table<uint8_t, 16> display_brightness::duty_table PROGMEM {{8, 9, 11, 15, 21, 30, 41, 54, 70, 88, 109, 133, 159, 188, 220, 255}};
+#endif
+
+#else
+
+class display_brightness
+{
+public:
+	void init() {}
+	void on_conversion(uint16_t) {}
+	void update(bool) {}
+	uint8_t duty() const {
+		return 255;
+	}
+};
+
+#endif
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef CLOCK_PROFILE_H
+#define CLOCK_PROFILE_H
+
+/*
+  システムクロックの切り替え
+
+  待機中の状態(ready_to_start, show_score, show_high_score)はほとんど計算しないので、
+  CLKPRでシステムクロックを落とす(8MHzなら1/8の1MHz。board_profile.h)。playingに入るときに全速に戻す。
+  クロックを切り替えるのと同時にTimer0のプリスケーラとTOPも設定し直し、
+  Timer0に入るクロック(TIMER_HZ。8MHzなら125kHz)を変えないようにする。TCNT0も引き継がれるので、
+  ティックの間隔、表示の切り替え、ボタンの無効時間は切り替えをまたいでも変わらない。
+  1ティックはTICK_COUNTSカウントで、FAST_TICKでなければBASE_TICK_COUNTS(約2.048ms、約488Hz)、
+  FAST_TICKならその約1/4(8MHzで62カウント、約2016Hz)。
+
+  UARTを使っているときは、ボーレートが変わらないようにUBRR0も一緒に設定し直す。
+  待機中のクロックでボーレートの誤差が2%を超えるとき(16MHz)は、UARTを使うなら低速化しない。
+  機能が全速のクロックを必要とする間は、hold_fullで低速化を止められる。
+  受信(REMOTE_COMMAND、VERSUS)を有効にしたときは、uart_port::enable_receiveがずっと止めておく。
+  FAST_TICKでは待機中も低速化しない。1MHzでは1ティックが約500サイクルしかなく、ティックの処理が
+  収まるかをまだ測っていないため。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/power.h>
+
+#include "config.h"
+#include "board_profile.h"
+#include "power_profile.h"
+
+// FAST_TICKでないときの1ティック(約2.048ms)のTimer0のカウント数。8MHzなら256
+constexpr uint16_t BASE_TICK_COUNTS = static_cast<uint16_t>(TIMER_HZ * 256 / 125000);
+
+// 1ティックのTimer0のカウント数
+constexpr uint16_t TICK_COUNTS = FAST_TICK ? BASE_TICK_COUNTS * 62 / 256 : BASE_TICK_COUNTS;
+
+static_assert(TICK_COUNTS <= 256, "tick must fit in 8-bit Timer0.");
+
+enum class clock_level : uint8_t
+{
+	full,    // F_CPU
+	idle,    // F_CPU / IDLE_DIV
+};
+
+// UARTのボーレート。8MHzならどちらのクロックでも誤差0.2%で出せる値にしている
+constexpr uint32_t UART_BAUD = 9600;
+
+// f_cpuでUART_BAUDを出すためのUBRR0(U2X)
+constexpr uint16_t ubrr_for_baud(uint32_t f_cpu)
+{
+	return static_cast<uint16_t>((f_cpu + UART_BAUD * 4) / (UART_BAUD * 8) - 1);
+}
+
+// f_cpuでubrr_for_baudを使ったときの実際のボーレート
+constexpr uint32_t actual_baud(uint32_t f_cpu)
+{
+	return f_cpu / (static_cast<uint32_t>(ubrr_for_baud(f_cpu) + 1u) * 8);
+}
+
+// f_cpuでUART_BAUDの誤差が2%以内か
+constexpr bool baud_within_tolerance(uint32_t f_cpu)
+{
+	return actual_baud(f_cpu) * 50 >= UART_BAUD * 49 && actual_baud(f_cpu) * 50 <= UART_BAUD * 51;
+}
+
+// クロック設定の管理。Singleton
+class clock_profile
+{
+public:
+	static clock_profile& instance() {
+		static clock_profile object;
+		return object;
+	}
+
+	// 全速で起動する。Timer0はCTCモードに設定しておくこと
+	void init() {
+		apply(settings[static_cast<uint8_t>(clock_level::full)]);
+		m_current = clock_level::full;
+	}
+
+	// 状態が必要とするクロック。状態遷移のときに呼ぶ
+	void set_level(clock_level level) {
+		m_requested = level;
+		update();
+	}
+
+	// 全速が必要な間、低速化を止める。参照カウント
+	void hold_full() {
+		++m_full_holds;
+		update();
+	}
+
+	void release_full() {
+		if (m_full_holds == 0) return;
+		--m_full_holds;
+		update();
+	}
+
+	clock_level level() const {
+		return m_current;
+	}
+
+	// 現在のクロックでのUBRR0(U2X)
+	uint16_t uart_ubrr() const {
+		return settings[static_cast<uint8_t>(m_current)].uart_ubrr;
+	}
+
+	// 現在のクロックでのADCSRAのADPSビット
+	uint8_t adc_prescaler() const {
+		return settings[static_cast<uint8_t>(m_current)].adc_ps;
+	}
+
+private:
+	clock_profile() = default;
+
+	struct setting
+	{
+		clock_div_t clock_div;
+		uint8_t timer0_cs;    // TCCR0BのCSビット
+		uint8_t timer0_top;    // OCR0A
+		uint16_t uart_ubrr;    // UBRR0(U2X)
+		uint8_t adc_ps;    // ADCSRAのADPSビット
+	};
+
+	static constexpr uint32_t IDLE_HZ = F_CPU >> static_cast<uint8_t>(board_clock::IDLE_DIV);
+	// 待機中もUARTのボーレートが合うか。合わなければ待機中も全速のまま。
+	// FAST_TICKと低速化の組み合わせは負荷を測っていないので使わない
+	static constexpr bool IDLE_SLOWDOWN = !FAST_TICK && (!USE_UART || baud_within_tolerance(IDLE_HZ));
+
+	// どちらの設定もTimer0のクロックはTIMER_HZ、1ティックはTICK_COUNTSカウント
+	// ADCのクロックもどちらも同じ(50～200kHzの範囲)
+	static constexpr setting settings[2]
+	{
+		{clock_div_1, board_clock::TIMER0_CS, TICK_COUNTS - 1, ubrr_for_baud(F_CPU), board_clock::ADC_PS},    // full
+		IDLE_SLOWDOWN ?
+			setting{board_clock::IDLE_DIV, board_clock::IDLE_TIMER0_CS, TICK_COUNTS - 1, ubrr_for_baud(IDLE_HZ), board_clock::IDLE_ADC_PS} :
+			setting{clock_div_1, board_clock::TIMER0_CS, TICK_COUNTS - 1, ubrr_for_baud(F_CPU), board_clock::ADC_PS},    // idle
+	};
+
+	void update() {
+		clock_level level = m_full_holds > 0 ? clock_level::full : m_requested;
+		if (level == m_current) return;
+		apply(settings[static_cast<uint8_t>(level)]);
+		m_current = level;
+	}
+
+	static void apply(const setting& s) {
+		uint8_t sreg = SREG;
+		cli();
+		// プリスケーラを止めてから切り替え、同時に再開する
+		GTCCR = _BV(TSM) | _BV(PSRSYNC);
+		clock_prescale_set(s.clock_div);
+		TCCR0B = s.timer0_cs;
+		OCR0A = s.timer0_top;
+		if (power_profile::instance().is_enabled(peripheral::usart0)) {
+			UBRR0 = s.uart_ubrr;
+		}
+		if (power_profile::instance().is_enabled(peripheral::adc)) {
+			// ADIFは1を書くと消えるので、0で書き戻す(変換終了の割り込みを落とさない)
+			ADCSRA = static_cast<uint8_t>((ADCSRA & ~(_BV(ADIF) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0))) | s.adc_ps);
+		}
+		GTCCR = 0;
+		SREG = sreg;
+	}
+
+	clock_level m_current = clock_level::full;
+	clock_level m_requested = clock_level::full;
+	uint8_t m_full_holds = 0;
+};
+
+constexpr clock_profile::setting clock_profile::settings[2];
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+/*
+  リモートコマンドの受信
+
+  USART_RX_vectから1バイトずつfeedに渡す。状態遷移で1バイトずつ処理するので、
+  どのバイトでも処理時間は一定で、待つことはない。
+  揃ったコマンドは1つだけ保持し、タイマ割り込みの中でtakeで取り出して実行する。
+  取り出される前に次のコマンドが来たら捨てる(ホストは応答が来なければ再送する)。
+ */
+
+#include <stdint.h>
+
+#include "command_protocol.h"
+
+class command_parser
+{
+public:
+	void feed(uint8_t byte) {
+		switch (m_state) {
+		case state::sync:
+			if (byte == command_protocol::SYNC) {
+				m_state = state::length;
+			}
+			break;
+		case state::length:
+			if (byte == 0 || byte > command_protocol::MAX_BODY) {
+				error();
+				break;
+			}
+			m_length = byte;
+			m_sum = byte;
+			m_size = 0;
+			m_body[1] = 0;
+			m_state = state::body;
+			break;
+		case state::body:
+			m_body[m_size++] = byte;
+			m_sum = static_cast<uint8_t>(m_sum + byte);
+			if (m_size == m_length) {
+				m_state = state::checksum;
+			}
+			break;
+		case state::checksum:
+			m_state = state::sync;
+			if (static_cast<uint8_t>(m_sum + byte) != 0 || m_ready) {
+				++m_errors;
+				break;
+			}
+			m_command.id = static_cast<command_protocol::command_id>(m_body[0]);
+			m_command.argument = m_body[1];
+			m_ready = true;
+			break;
+		}
+	}
+
+	// フレーミングエラー、オーバーランのとき
+	void error() {
+		m_state = state::sync;
+		++m_errors;
+	}
+
+	bool take(command_protocol::command& command) {
+		if (!m_ready) return false;
+		command = m_command;
+		m_ready = false;
+		return true;
+	}
+
+	uint8_t errors() const {
+		return m_errors;
+	}
+
+private:
+	enum class state : uint8_t
+	{
+		sync,
+		length,
+		body,
+		checksum,
+	};
+
+	state m_state = state::sync;
+	uint8_t m_length = 0;
+	uint8_t m_size = 0;
+	uint8_t m_sum = 0;
+	uint8_t m_body[command_protocol::MAX_BODY];
+	command_protocol::command m_command;
+	bool m_ready = false;
+	uint8_t m_errors = 0;
+};
+
+#endif
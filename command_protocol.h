@@ -0,0 +1,37 @@
+#ifndef COMMAND_PROTOCOL_H
+#define COMMAND_PROTOCOL_H
+
+/*
+  リモートコマンドの形式。ホストから筐体へ送る
+
+  [SYNC][len][command][argument...][sum]
+    SYNC      0x5A
+    len       commandとargumentを合わせたバイト数
+    sum       lenからsumまでを足すと0(下位8ビット)になるように決める
+  応答はテレメトリと同じ形式のレコード(ackまたはstatus)で返す。telemetry_protocol.hを参照
+ */
+
+#include <stdint.h>
+
+namespace command_protocol
+{
+	constexpr uint8_t SYNC = 0x5A;
+	constexpr uint8_t MAX_BODY = 2;    // command + argument
+
+	enum class command_id : uint8_t
+	{
+		get_status = 0x01,    // 応答はstatus
+		set_difficulty = 0x02,    // argument: 難易度(0: easy, 1: normal, 2: hard)
+		erase_score = 0x03,
+		diagnostics = 0x04,    // 診断画面に入る
+		dump_trace = 0x05,    // イベントトレースを古い順にtraceレコードで送り、最後にackを返す
+	};
+
+	struct command
+	{
+		command_id id;
+		uint8_t argument;
+	};
+}
+
+#endif
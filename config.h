@@ -0,0 +1,167 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/*
+  ビルドオプションの既定値。Makefileから-Dで上書きする
+ */
+
+// PD0/PD1(RXD/TXD)をUARTに使う。7セグのA/BはPD4/PB0に移し、
+// ハイスコア表示スイッチと消去スイッチは使えなくなる
+#ifndef UART_PIN_REMAP
+#define UART_PIN_REMAP 0
+#endif
+
+// ゲームのイベントをUARTで送信する
+#ifndef TELEMETRY
+#define TELEMETRY 0
+#endif
+
+// UARTからのコマンドで状態の取得や設定の変更をできるようにする
+#ifndef REMOTE_COMMAND
+#define REMOTE_COMMAND 0
+#endif
+
+// イベントトレースのレコード数(2の累乗、64以下)。0でトレースしない。trace.hを参照
+#ifndef TRACE_DEPTH
+#define TRACE_DEPTH 0
+#endif
+
+// LEDバーを74HC595のチェーンで駆動するときのLEDの数(8の倍数、32以下)。0ならGPIOに直接つないだ10個
+#ifndef BAR_SPI_LENGTH
+#define BAR_SPI_LENGTH 0
+#endif
+
+// 効果音を鳴らすタイマと出力ピン。sound.hを参照
+//   SOUND_OC2B: PD3。7セグのFを移す
+//   SOUND_OC1A: PB1。ゲームスイッチを移す
+// 移し先は、74HC595のバー(BAR_SPI_LENGTH)なら空いているPC0、そうでなければ消去スイッチのPB0
+// (消去スイッチは使えなくなる)
+#define SOUND_OC2B 1
+#define SOUND_OC1A 2
+#ifndef SOUND
+#define SOUND 0
+#endif
+
+// 周囲の明るさで輝度を変えるときの光センサのADCチャンネル(6か7。TQFPのみ)。0なら使わない
+// brightness.hを参照
+#ifndef AMBIENT_LIGHT
+#define AMBIENT_LIGHT 0
+#endif
+
+// プレイ中のバーの移動をTimer1のコンペアマッチで、ボタンの判定をピン変化割り込みで行う。
+// 速さを8μs単位で決められ、ティックごとのゲームの処理がなくなる。bar_timer.hを参照
+#ifndef TICKLESS_PLAY
+#define TICKLESS_PLAY 0
+#endif
+
+// ティックを約2kHz(125kHz / 62 = 約2016Hz)にする。0なら約488Hz。
+// ボタンの判定とバーの移動が4倍細かくなる。CPU負荷はhokey-simの-Lで確かめること
+#ifndef FAST_TICK
+#define FAST_TICK 0
+#endif
+
+// 内部のバンドギャップで電源電圧を測り、低いときはEEPROMへの書き込みを後回しにして表示を暗くする。
+// supply.hを参照。SUPPLY_LOW_MVは電圧が低いとみなすしきい値、SUPPLY_BANDGAP_MVはバンドギャップの電圧
+#ifndef SUPPLY_MONITOR
+#define SUPPLY_MONITOR 0
+#endif
+#ifndef SUPPLY_LOW_MV
+#define SUPPLY_LOW_MV 3300
+#endif
+#ifndef SUPPLY_BANDGAP_MV
+#define SUPPLY_BANDGAP_MV 1100
+#endif
+
+// 電源断を検出するアナログコンパレータの入力(ADCのチャンネル6か7。TQFPのみ)。0なら使わない。
+// 使うときはEEPROMへの書き込みをライトバックにし、プレイの記録もEEPROMに残す。power_fail.hを参照
+#ifndef POWER_FAIL
+#define POWER_FAIL 0
+#endif
+
+// UARTでつないだもう1台と対戦する。VERSUS_INPUT_DELAYは入力を遅らせるフレーム数(1～15)で、
+// 通信の遅れがこれより短ければ待たずに進む。versus.hを参照
+#ifndef VERSUS
+#define VERSUS 0
+#endif
+#ifndef VERSUS_INPUT_DELAY
+#define VERSUS_INPUT_DELAY 4
+#endif
+
+// 電源投入時に自己診断(ランプ、スイッチ、EEPROM、タイマのクロック)を行い、異常をコードで表示する。
+// 200ms以内に終わる。self_test.hを参照
+#ifndef SELF_TEST
+#define SELF_TEST 1
+#endif
+
+// 処理時間の計測用に、PROBE_SPANで区間の出入りをGPIOR0に書く。probe.hを参照
+#ifndef PROBE
+#define PROBE 0
+#endif
+
+#if TELEMETRY && !UART_PIN_REMAP
+#error "TELEMETRY requires UART_PIN_REMAP"
+#endif
+#if REMOTE_COMMAND && !UART_PIN_REMAP
+#error "REMOTE_COMMAND requires UART_PIN_REMAP"
+#endif
+
+#if TRACE_DEPTH > 64
+#error "TRACE_DEPTH must be 64 or less"
+#endif
+
+#if SOUND != 0 && SOUND != SOUND_OC2B && SOUND != SOUND_OC1A
+#error "SOUND must be 0, SOUND_OC2B(1) or SOUND_OC1A(2)"
+#endif
+#if SOUND && UART_PIN_REMAP && !BAR_SPI_LENGTH
+#error "SOUND with UART_PIN_REMAP requires BAR_SPI_LENGTH (no free pin for the moved function)"
+#endif
+
+#if AMBIENT_LIGHT != 0 && AMBIENT_LIGHT != 6 && AMBIENT_LIGHT != 7
+#error "AMBIENT_LIGHT must be 0, 6 or 7"
+#endif
+
+#if TICKLESS_PLAY && SOUND == SOUND_OC1A
+#error "TICKLESS_PLAY uses Timer1 and the game switch on PB1, which conflicts with SOUND_OC1A"
+#endif
+
+#if FAST_TICK != 0 && FAST_TICK != 1
+#error "FAST_TICK must be 0 or 1"
+#endif
+
+#if PROBE != 0 && PROBE != 1
+#error "PROBE must be 0 or 1"
+#endif
+
+#if SUPPLY_MONITOR != 0 && SUPPLY_MONITOR != 1
+#error "SUPPLY_MONITOR must be 0 or 1"
+#endif
+
+#if POWER_FAIL != 0 && POWER_FAIL != 6 && POWER_FAIL != 7
+#error "POWER_FAIL must be 0, 6 or 7"
+#endif
+#if POWER_FAIL && (AMBIENT_LIGHT || SUPPLY_MONITOR)
+#error "POWER_FAIL uses the ADC multiplexer for the comparator, which conflicts with AMBIENT_LIGHT and SUPPLY_MONITOR"
+#endif
+
+#if VERSUS != 0 && VERSUS != 1
+#error "VERSUS must be 0 or 1"
+#endif
+#if VERSUS && !UART_PIN_REMAP
+#error "VERSUS requires UART_PIN_REMAP"
+#endif
+#if VERSUS && (TELEMETRY || REMOTE_COMMAND)
+#error "VERSUS uses the UART for the link, which conflicts with TELEMETRY and REMOTE_COMMAND"
+#endif
+#if VERSUS_INPUT_DELAY < 1 || VERSUS_INPUT_DELAY > 15
+#error "VERSUS_INPUT_DELAY must be 1 to 15"
+#endif
+
+#if SELF_TEST != 0 && SELF_TEST != 1
+#error "SELF_TEST must be 0 or 1"
+#endif
+
+#define USE_UART (TELEMETRY || REMOTE_COMMAND || VERSUS)
+#define USE_ADC (AMBIENT_LIGHT || SUPPLY_MONITOR)
+#define USE_DIMMING (AMBIENT_LIGHT || SUPPLY_MONITOR)
+
+#endif
@@ -0,0 +1,352 @@
+#ifndef CONTAINERS_H
+#define CONTAINERS_H
+
+/*
+  固定長のコンテナ
+
+  どれもヒープと例外を使わず、容量はテンプレート引数で決める。標準ライブラリのヘッダも使わないので、
+  AVRでもホストでも同じように動く(bench/containers_bench.cppで速さを、bench/containers_avr.cppで
+  実体化ごとのコードの大きさを測る)。
+  要素は配列で持つので、Tはデフォルトコンストラクタで作れてコピーできること。容量いっぱいのときの
+  追加は何もせずにfalseを返す。割り込みとメインの両方から触るときは、呼ぶ側で割り込みを止めること。
+
+    array<T, N>            ただの配列
+    ring_buffer<T, N>      FIFO。Nは2の累乗(128以下)。添字はマスクで回す
+    static_vector<T, N>    N個(255以下)までの可変長の列
+    bitset<N, Word>        Nビットの集合。まとめて行う演算はWord単位(既定はAVRのレジスタ幅のuint8_t)
+    flash_table<T, N>      フラッシュに置く定数表。オブジェクトをPROGMEMで定義し、[]で読む
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#endif
+
+// 配列。最低限の機能のみ
+template <class T, int N>
+struct array
+{
+	T elem[N];
+
+	T& operator [] (int i) {
+		return elem[i];
+	}
+	const T& operator [] (int i) const {
+		return elem[i];
+	}
+
+	T* begin() {
+		return elem;
+	}
+	const T* begin() const {
+		return elem;
+	}
+	T* end() {
+		return elem + N;
+	}
+	const T* end() const {
+		return elem + N;
+	}
+};
+
+// FIFO。読み書きの位置は回りっぱなしのカウンタで持ち、差が個数になる(容量いっぱいまで使える)
+template <class T, uint8_t Capacity>
+class ring_buffer
+{
+	static_assert(Capacity >= 2 && Capacity <= 128 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of 2 up to 128.");
+public:
+	bool push(const T& value) {
+		if (full()) return false;
+		m_elem[m_head & MASK] = value;
+		++m_head;
+		return true;
+	}
+
+	bool pop(T& value) {
+		if (empty()) return false;
+		value = m_elem[m_tail & MASK];
+		++m_tail;
+		return true;
+	}
+
+	// 先頭からi番目。i < size()であること
+	T& peek(uint8_t i = 0) {
+		return m_elem[static_cast<uint8_t>(m_tail + i) & MASK];
+	}
+	const T& peek(uint8_t i = 0) const {
+		return m_elem[static_cast<uint8_t>(m_tail + i) & MASK];
+	}
+
+	// 先頭からcount個を捨てる。count <= size()であること
+	void drop(uint8_t count) {
+		m_tail = static_cast<uint8_t>(m_tail + count);
+	}
+
+	void clear() {
+		m_tail = m_head;
+	}
+
+	uint8_t size() const {
+		return static_cast<uint8_t>(m_head - m_tail);
+	}
+	uint8_t space() const {
+		return static_cast<uint8_t>(Capacity - size());
+	}
+	bool empty() const {
+		return m_head == m_tail;
+	}
+	bool full() const {
+		return size() == Capacity;
+	}
+	static constexpr uint8_t capacity() {
+		return Capacity;
+	}
+
+private:
+	static constexpr uint8_t MASK = Capacity - 1;
+
+	T m_elem[Capacity];
+	uint8_t m_head = 0;    // 次に書く位置
+	uint8_t m_tail = 0;    // 次に読む位置
+};
+
+// 可変長の列
+template <class T, uint8_t Capacity>
+class static_vector
+{
+	static_assert(Capacity >= 1, "capacity must be 1 or more.");
+public:
+	bool push_back(const T& value) {
+		if (full()) return false;
+		m_elem[m_size++] = value;
+		return true;
+	}
+
+	// 空でないこと
+	void pop_back() {
+		--m_size;
+	}
+
+	// 後ろを詰める。順番を保たなくてよければerase_unorderedのほうが速い
+	void erase(uint8_t i) {
+		for (uint8_t j = i; static_cast<uint8_t>(j + 1) < m_size; ++j) {
+			m_elem[j] = m_elem[j + 1];
+		}
+		--m_size;
+	}
+
+	// 最後の要素をiに移す
+	void erase_unordered(uint8_t i) {
+		m_elem[i] = m_elem[--m_size];
+	}
+
+	void clear() {
+		m_size = 0;
+	}
+
+	T& operator [] (uint8_t i) {
+		return m_elem[i];
+	}
+	const T& operator [] (uint8_t i) const {
+		return m_elem[i];
+	}
+	T& back() {
+		return m_elem[m_size - 1];
+	}
+	const T& back() const {
+		return m_elem[m_size - 1];
+	}
+
+	T* begin() {
+		return m_elem;
+	}
+	const T* begin() const {
+		return m_elem;
+	}
+	T* end() {
+		return m_elem + m_size;
+	}
+	const T* end() const {
+		return m_elem + m_size;
+	}
+
+	uint8_t size() const {
+		return m_size;
+	}
+	bool empty() const {
+		return m_size == 0;
+	}
+	bool full() const {
+		return m_size == Capacity;
+	}
+	static constexpr uint8_t capacity() {
+		return Capacity;
+	}
+
+private:
+	T m_elem[Capacity];
+	uint8_t m_size = 0;
+};
+
+// ビットの集合。最後のWordの使わないビットは常に0にしておく(countやanyで見なくて済むように)
+template <uint16_t N, class Word = uint8_t>
+class bitset
+{
+	static_assert(N >= 1, "size must be 1 or more.");
+public:
+	static constexpr uint8_t WORD_BITS = sizeof(Word) * 8;
+	static constexpr uint16_t WORDS = (N + WORD_BITS - 1) / WORD_BITS;
+
+	void set(uint16_t i) {
+		m_words[i / WORD_BITS] = static_cast<Word>(m_words[i / WORD_BITS] | bit(i));
+	}
+	void reset(uint16_t i) {
+		m_words[i / WORD_BITS] = static_cast<Word>(m_words[i / WORD_BITS] & ~bit(i));
+	}
+	void flip(uint16_t i) {
+		m_words[i / WORD_BITS] = static_cast<Word>(m_words[i / WORD_BITS] ^ bit(i));
+	}
+	void assign(uint16_t i, bool value) {
+		if (value) {
+			set(i);
+		} else {
+			reset(i);
+		}
+	}
+	bool test(uint16_t i) const {
+		return (m_words[i / WORD_BITS] & bit(i)) != 0;
+	}
+
+	void set_all() {
+		for (uint16_t w = 0; w < WORDS; ++w) {
+			m_words[w] = static_cast<Word>(~Word(0));
+		}
+		m_words[WORDS - 1] = LAST_MASK;
+	}
+	void reset_all() {
+		for (uint16_t w = 0; w < WORDS; ++w) {
+			m_words[w] = 0;
+		}
+	}
+
+	bool any() const {
+		for (uint16_t w = 0; w < WORDS; ++w) {
+			if (m_words[w] != 0) return true;
+		}
+		return false;
+	}
+	bool none() const {
+		return !any();
+	}
+
+	// 立っているビットの数。立っているビットの分だけ回る
+	uint16_t count() const {
+		uint16_t n = 0;
+		for (uint16_t w = 0; w < WORDS; ++w) {
+			for (Word v = m_words[w]; v != 0; v = static_cast<Word>(v & (v - 1))) {
+				++n;
+			}
+		}
+		return n;
+	}
+
+	// i以降で最初に立っているビット。なければN。0のWordは丸ごと飛ばす
+	uint16_t find_next(uint16_t i) const {
+		if (i >= N) return N;
+		uint16_t w = i / WORD_BITS;
+		Word v = static_cast<Word>(m_words[w] & ~static_cast<Word>(bit(i) - 1));
+		while (v == 0) {
+			if (++w >= WORDS) return N;
+			v = m_words[w];
+		}
+		uint16_t index = static_cast<uint16_t>(w * WORD_BITS);
+		while ((v & 1) == 0) {
+			v = static_cast<Word>(v >> 1);
+			++index;
+		}
+		return index;
+	}
+	uint16_t find_first() const {
+		return find_next(0);
+	}
+
+	bitset& operator &= (const bitset& other) {
+		for (uint16_t w = 0; w < WORDS; ++w) m_words[w] = static_cast<Word>(m_words[w] & other.m_words[w]);
+		return *this;
+	}
+	bitset& operator |= (const bitset& other) {
+		for (uint16_t w = 0; w < WORDS; ++w) m_words[w] = static_cast<Word>(m_words[w] | other.m_words[w]);
+		return *this;
+	}
+	bitset& operator ^= (const bitset& other) {
+		for (uint16_t w = 0; w < WORDS; ++w) m_words[w] = static_cast<Word>(m_words[w] ^ other.m_words[w]);
+		return *this;
+	}
+	bool operator == (const bitset& other) const {
+		for (uint16_t w = 0; w < WORDS; ++w) {
+			if (m_words[w] != other.m_words[w]) return false;
+		}
+		return true;
+	}
+	bool operator != (const bitset& other) const {
+		return !(*this == other);
+	}
+
+	// Word単位で読み書きする。最後のWordの使わないビットは書かないこと
+	Word word(uint16_t w) const {
+		return m_words[w];
+	}
+	void set_word(uint16_t w, Word value) {
+		m_words[w] = value;
+	}
+
+	static constexpr uint16_t size() {
+		return N;
+	}
+
+private:
+	static constexpr Word LAST_MASK = N % WORD_BITS == 0 ? static_cast<Word>(~Word(0)) : static_cast<Word>((Word(1) << (N % WORD_BITS)) - 1);
+
+	static Word bit(uint16_t i) {
+		return static_cast<Word>(Word(1) << (i % WORD_BITS));
+	}
+
+	Word m_words[WORDS] {};
+};
+
+/*
+  フラッシュに置く定数表。オブジェクトごとPROGMEMにするので、定義は次のようにする
+    static const flash_table<uint8_t, 4> table PROGMEM {{1, 2, 3, 4}};
+  []はAVRではpgm_read_byte、pgm_read_word(1、2バイトの型)かmemcpy_Pで読む。ホストではふつうに読む
+ */
+template <class T, uint8_t N>
+struct flash_table
+{
+	T elem[N];
+
+	T operator [] (uint8_t i) const {
+		T value;
+#if defined(__AVR__)
+		if (sizeof(T) == 1) {
+			uint8_t b = pgm_read_byte(&elem[i]);
+			memcpy(&value, &b, 1);
+		} else if (sizeof(T) == 2) {
+			uint16_t w = pgm_read_word(&elem[i]);
+			memcpy(&value, &w, 2);
+		} else {
+			memcpy_P(&value, &elem[i], sizeof(T));
+		}
+#else
+		memcpy(&value, &elem[i], sizeof(T));
+#endif
+		return value;
+	}
+
+	static constexpr uint8_t size() {
+		return N;
+	}
+};
+
+#endif
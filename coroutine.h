@@ -0,0 +1,68 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+/*
+  スタックを持たないコルーチン(switchで再開位置に飛ぶ)
+
+  点滅のような時間に沿った手順を、状態とカウンタに分けずに上から順に書くためのもの。
+  持つのは再開位置の1バイトだけ。再開位置はCORO_YIELDごとに__COUNTER__で振るので、
+  1つの関数の中では連番になり、再開はswitchの表引き(待つ場所が少なければ数回の比較)で済む。
+  待っている間はだれもコルーチンを呼ばないので、ティックごとの処理や割り算はない。
+
+    void script() {
+        CORO_BEGIN(m_co);
+        for (m_i = 0; m_i < 3; ++m_i) {
+            on();
+            CORO_AWAIT(m_co, wake_me_after(100));    // 式を評価してから抜け、次に呼ばれたらここから続ける
+            off();
+            CORO_AWAIT(m_co, wake_me_after(100));
+        }
+        CORO_END(m_co);
+        finished();    // 最後まで進んだときに1回だけ実行する
+    }
+
+  注意
+    ・スタックを持たないので、CORO_YIELDをまたいで使う変数はメンバにすること(ローカル変数は消える)
+    ・CORO_BEGINとCORO_ENDの間にswitch文を書かないこと(caseが内側のswitchのものになる)
+    ・終わったコルーチンを呼んでも何もしない。最初からやり直すにはrestart()
+ */
+
+#include <stdint.h>
+
+class coroutine
+{
+public:
+	static constexpr uint8_t FINISHED = 0xFF;
+
+	void restart() {
+		m_resume = 0;
+	}
+
+	bool finished() const {
+		return m_resume == FINISHED;
+	}
+
+	uint8_t m_resume = FINISHED;    // 次に再開する位置。0なら最初から
+};
+
+// 終わったコルーチン(FINISHED)はdefaultで何もせずに戻る
+#define CORO_BEGIN(co) switch ((co).m_resume) { default: return; case 0:
+
+#define CORO_YIELD_AT(co, point, ...) \
+	do { \
+		static_assert((point) < coroutine::FINISHED, "too many yield points in this translation unit."); \
+		(co).m_resume = (point); \
+		__VA_ARGS__; \
+		return; \
+	case (point):; \
+	} while (0)
+
+// 抜ける。次に呼ばれたらこの次から続ける
+#define CORO_YIELD(co) CORO_YIELD_AT(co, __COUNTER__ + 1, (void)0)
+
+// exprを評価してから抜ける(再開を頼む式を書く)
+#define CORO_AWAIT(co, expr) CORO_YIELD_AT(co, __COUNTER__ + 1, expr)
+
+#define CORO_END(co) } (co).m_resume = coroutine::FINISHED
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef PERSISTENT_H
+#define PERSISTENT_H
+
+/*
+  EEPROMに保存する値の書き込み
+
+  書き込む値はRAMに置いて書き込み待ちの印を付け、タイマ割り込みのflushで書く。
+  書くのはティックごとに1バイトまでで、前の書き込み(約3.4ms)が終わっていなければ待たずに
+  次のティックに回すので、割り込みの中で書き込みの終わりを待つことはない。
+  値が変わっていなければ書かない(eeprom_update_byte)。
+
+  電源電圧が低いとき(supply_monitor::eeprom_safeがfalse)に書くと、書き込みの途中で電圧が
+  下がって値が壊れることがあるので、電圧が戻るまで書き込みを後回しにする。
+
+  POWER_FAILのときはライトバックにする。値はRAMに置いたままflushでは書かず、電源断を
+  検出したとき(power_fail.h)にcommitで書き込み待ちのバイトだけをまとめて書く。
+  プレイの記録のように頻繁に変わる値も、EEPROMを書き換えるのは電源を切るときの1回になる。
+  ウォッチドッグのリセットから再開したときは、書き込み待ちの印が消えているので、どのモードでも
+  各Singletonが写しの値をもう一度writeする(書き込み済みの値はeeprom_update_byteが書かない)。
+  リセットスイッチで止めたときは書き込み待ちの値は失われる。
+ */
+
+#include <stdint.h>
+
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+
+#include "config.h"
+#include "supply.h"
+#include "probe.h"
+
+// EEPROMに保存する値。16ビットの値は下位、上位の順に2つ使う
+enum class persistent_id : uint8_t
+{
+	high_score,
+	difficulty,
+	games,    // POWER_FAILのときだけ
+	games_high,
+	hits,    // POWER_FAILのときだけ
+	hits_high,
+	COUNT,
+};
+
+class persistent_store
+{
+public:
+	static constexpr bool WRITE_BACK = POWER_FAIL != 0;
+
+	persistent_store(const supply_monitor& supply) : m_supply(supply) {}
+
+	// addressにvalueを書く。ライトバックでなく、書けるならこのティックのうちに書く
+	void write(persistent_id id, uint8_t* address, uint8_t value) {
+		entry& e = m_entries[static_cast<uint8_t>(id)];
+		e.address = address;
+		e.value = value;
+		m_dirty = static_cast<uint8_t>(m_dirty | bit(id));
+		flush();
+	}
+
+	void write(persistent_id id, uint16_t* address, uint16_t value) {
+		uint8_t* p = reinterpret_cast<uint8_t*>(address);
+		write(id, p, static_cast<uint8_t>(value));
+		write(static_cast<persistent_id>(static_cast<uint8_t>(id) + 1), p + 1, static_cast<uint8_t>(value >> 8));
+	}
+
+	// タイマ割り込みから毎ティック呼ぶ
+	void flush() {
+		if (WRITE_BACK || m_dirty == 0 || !m_supply.eeprom_safe() || !eeprom_is_ready()) return;
+		uint8_t id = 0;
+		while ((m_dirty & _BV(id)) == 0) ++id;
+		m_dirty = static_cast<uint8_t>(m_dirty & ~_BV(id));
+		PROBE_SPAN(probe_id::eeprom_write);
+		eeprom_update_byte(m_entries[id].address, m_entries[id].value);
+	}
+
+	// 書き込み待ちの値をすべて書く。書き終わるまで戻らない(1バイト約3.4ms)。書いたバイト数を返す。
+	// 電源断の割り込みから呼ぶ
+	uint8_t commit() {
+		uint8_t count = 0;
+		for (uint8_t id = 0; id < COUNT; ++id) {
+			if ((m_dirty & _BV(id)) == 0) continue;
+			PROBE_SPAN(probe_id::eeprom_write);
+			wdt_reset();
+			eeprom_update_byte(m_entries[id].address, m_entries[id].value);
+			++count;
+		}
+		m_dirty = 0;
+		return count;
+	}
+
+	// 書き込み待ちの値があるか
+	bool pending() const {
+		return m_dirty != 0;
+	}
+
+private:
+	static constexpr uint8_t COUNT = static_cast<uint8_t>(persistent_id::COUNT);
+	static_assert(COUNT <= 8, "dirty flags must fit in 8 bits.");
+
+	struct entry
+	{
+		uint8_t* address;
+		uint8_t value;
+	};
+
+	static uint8_t bit(persistent_id id) {
+		return static_cast<uint8_t>(_BV(static_cast<uint8_t>(id)));
+	}
+
+	const supply_monitor& m_supply;
+	entry m_entries[COUNT] {};
+	uint8_t m_dirty = 0;    // 書き込み待ち(ビットがpersistent_id)
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef POWER_FAIL_H
+#define POWER_FAIL_H
+
+/*
+  電源断の検出(POWER_FAIL = ADCのチャンネルのとき)
+
+  レギュレータの前(電池やACアダプタの側)の電圧を抵抗で分圧してADC6かADC7に入れ、
+  アナログコンパレータで内部の1.1Vバンドギャップと比べる。分圧した電圧が1.1Vを下回ったら
+  (ACOが0から1になったら)ANALOG_COMP_vectが起こる。
+  コンパレータの-入力はADCのマルチプレクサ(ACME)から取るので、ADCは有効にできない
+  (AMBIENT_LIGHT、SUPPLY_MONITORとは一緒に使えない)。PRADCが1だとマルチプレクサが
+  使えないので、ADCのクロックは供給したままにする。
+
+  分圧比は、しきい値の電圧でVCCがまだ保たれているように決める。例えば9Vの電池から5Vの
+  レギュレータなら、入力が6.5Vで1.1Vになるように(10kΩと2.2kΩで約6.1V)する。
+  しきい値を下回ってからVCCが下がりきるまでの時間(ホールドアップ時間)が、書き込み待ちの
+  バイト数 × 約3.4ms(EEPROMの1バイトの書き込み)より長くなるように、レギュレータの入力の
+  コンデンサを選ぶこと。persistent_idの6バイトで約20ms。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <util/delay.h>
+
+#include "config.h"
+#include "power_profile.h"
+
+#if POWER_FAIL
+
+class power_fail_detector
+{
+public:
+	void init() {
+		power_profile::instance().acquire(peripheral::adc);
+		ADCSRA = 0;
+		ADMUX = POWER_FAIL;
+		ADCSRB = _BV(ACME);
+		// ACISを変えるときとバンドギャップが安定するまで(約70μs)は割り込みを止めておく
+		ACSR = _BV(ACBG) | _BV(ACIS1) | _BV(ACIS0);
+		_delay_us(100);
+		ACSR = static_cast<uint8_t>(ACSR | _BV(ACI));
+		ACSR = static_cast<uint8_t>(ACSR | _BV(ACIE));
+	}
+};
+
+#else
+
+class power_fail_detector
+{
+public:
+	void init() {}
+};
+
+#endif
+
+#endif
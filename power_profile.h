@@ -0,0 +1,97 @@
+#ifndef POWER_PROFILE_H
+#define POWER_PROFILE_H
+
+/*
+  周辺機能の電源管理
+
+  ゲーム本体が使うのはTimer0, GPIO, EEPROMだけなので、それ以外のモジュール
+  (ADC, TWI, SPI, USART0, Timer1, Timer2)はPRRでクロックを止めておく。
+  アナログコンパレータも止める。アナログ入力と兼用のピンのデジタル入力バッファ(DIDR0, DIDR1)は
+  ピンの使い方で決まるので、io_init(avr-hokey.cpp)で切る。
+  周辺機能が必要な機能はacquireで有効にし、使い終わったらreleaseする。
+  参照カウントなので、複数の機能が同じ周辺を使っても問題ない。
+
+  消費電流の見積もり(VCC=5V, 8MHz, 25℃。データシートの代表値からの概算。LEDの電流は含まない)
+    ・変更前はメインループが空回りしていて常にActive。全周辺にクロックが供給されている
+    ・変更後はメインループがIdleスリープし、タイマ割り込みの間だけActiveになる
+    ・各状態でCPUが動いている割合は、1ティック(約2ms = 16384サイクル)あたりの割り込み処理の
+      サイクル数から見積もった
+
+    状態               CPU稼働率   変更前    変更後
+    ready_to_start       約3%     約5.9mA   約1.3mA
+    show_high_score      約3%     約5.9mA   約1.3mA
+    playing              約4%     約5.9mA   約1.4mA
+    show_score_blink     約4%     約5.9mA   約1.4mA
+    show_score           約3%     約5.9mA   約1.3mA
+
+    内訳(変更前): コア(Active) 約4.5mA + 周辺 約1.4mA(ADC 0.45, SPI 0.3, TWI 0.3, Timer2 0.25,
+                  USART0 0.2, Timer1 0.15, アナログコンパレータ 0.05程度)
+    内訳(変更後): コア(Idle) 約1.2mA + 稼働率 × (Active - Idle)の差分
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+
+// PRRで止められる周辺機能。値はPRRのビット位置
+enum class peripheral : uint8_t
+{
+	adc = PRADC,
+	usart0 = PRUSART0,
+	spi = PRSPI,
+	timer1 = PRTIM1,
+	timer0 = PRTIM0,
+	timer2 = PRTIM2,
+	twi = PRTWI,
+};
+
+// 周辺機能の電源管理。Singleton
+class power_profile
+{
+public:
+	static power_profile& instance() {
+		static power_profile object;
+		return object;
+	}
+
+	// すべての周辺機能を止める。他の初期化より先に呼ぶこと
+	void init() {
+		PRR = ALL_PERIPHERALS;
+		ACSR = _BV(ACD);    // アナログコンパレータ停止(ACIEも0にしておく)
+	}
+
+	// 周辺機能を使い始める。最初の1回でクロックを供給する
+	void acquire(peripheral p) {
+		uint8_t bit = static_cast<uint8_t>(p);
+		if (m_count[bit]++ == 0) {
+			PRR = static_cast<uint8_t>(PRR & ~_BV(bit));
+		}
+	}
+
+	// 周辺機能を使い終わる。誰も使わなくなったらクロックを止める
+	void release(peripheral p) {
+		uint8_t bit = static_cast<uint8_t>(p);
+		if (m_count[bit] == 0) return;
+		if (--m_count[bit] == 0) {
+			if (p == peripheral::adc) {
+				// ADCは止める前に無効にしておく必要がある
+				ADCSRA = static_cast<uint8_t>(ADCSRA & ~_BV(ADEN));
+			}
+			PRR = static_cast<uint8_t>(PRR | _BV(bit));
+		}
+	}
+
+	bool is_enabled(peripheral p) const {
+		return (PRR & _BV(static_cast<uint8_t>(p))) == 0;
+	}
+
+private:
+	power_profile() = default;
+
+	static constexpr uint8_t ALL_PERIPHERALS =
+		_BV(PRTWI) | _BV(PRTIM2) | _BV(PRTIM0) | _BV(PRTIM1) | _BV(PRSPI) | _BV(PRUSART0) | _BV(PRADC);
+
+	uint8_t m_count[8] = {};    // PRRのビットごとの参照カウント
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+/*
+  処理時間の計測用のプローブ(PROBE = 1のとき)
+
+  PROBE_SPAN(id)を書いたところからスコープの終わりまでを1つの区間とし、入るときにid、
+  出るときにid | PROBE_ENDをGPIOR0に書く。GPIOR0はどの周辺機能にもつながっていないので、
+  実機では書き込み(ldiとout)の分の時間が増えるだけ。
+  区間の中の処理が区間の外に動かされないように、書き込みの前後はメモリバリアにしている。
+  PROBE = 0のときはマクロが空になり、コードは何も残らない。
+
+  hokey-sim -Pで区間ごとのサイクル数の分布と、入れ子をたどった呼び出しごとの集計を表示する。
+  -Fでflamegraph.plに渡せる形式(区間の入れ子を;でつないだ行と、その区間自身のサイクル数)で書き出す。
+  ISRに書いた区間にはISRの入口と出口(レジスタの退避と復帰)は含まれない。
+ */
+
+#include <stdint.h>
+
+#include "config.h"
+
+// 区間の種類。1～127
+enum class probe_id : uint8_t
+{
+	timer_tick = 1,    // TIMER0_COMPA_vect
+	led_scan = 2,
+	game_update = 3,    // game_manager::update
+	timer_wheel = 4,
+	state_update = 5,    // 状態ごとの処理
+	eeprom_write = 6,
+	sound = 7,
+	brightness = 8,
+	bar_step = 9,    // TIMER1_COMPA_vect
+	game_switch = 10,    // PCINT0_vect
+	adc = 11,    // ADC_vect
+	uart = 12,    // UARTの割り込み
+	command = 13,    // コマンドの実行
+	supply = 14,    // 電源電圧の監視
+	power_fail = 15,    // ANALOG_COMP_vect
+};
+
+// 区間の終わりを表すビット
+constexpr uint8_t PROBE_END = 0x80;
+
+// 表示用。ホスト側のツールで使う
+inline const char* probe_name(uint8_t id)
+{
+	switch (static_cast<probe_id>(id)) {
+	case probe_id::timer_tick:
+		return "timer_tick";
+	case probe_id::led_scan:
+		return "led_scan";
+	case probe_id::game_update:
+		return "game_update";
+	case probe_id::timer_wheel:
+		return "timer_wheel";
+	case probe_id::state_update:
+		return "state_update";
+	case probe_id::eeprom_write:
+		return "eeprom_write";
+	case probe_id::sound:
+		return "sound";
+	case probe_id::brightness:
+		return "brightness";
+	case probe_id::bar_step:
+		return "bar_step";
+	case probe_id::game_switch:
+		return "game_switch";
+	case probe_id::adc:
+		return "adc";
+	case probe_id::uart:
+		return "uart";
+	case probe_id::command:
+		return "command";
+	case probe_id::supply:
+		return "supply";
+	case probe_id::power_fail:
+		return "power_fail";
+	}
+	return "unknown";
+}
+
+#if PROBE
+
+#include <avr/io.h>
+
+class probe_span
+{
+public:
+	explicit probe_span(probe_id id) : m_id(static_cast<uint8_t>(id)) {
+		asm volatile ("" ::: "memory");
+		GPIOR0 = m_id;
+		asm volatile ("" ::: "memory");
+	}
+
+	~probe_span() {
+		asm volatile ("" ::: "memory");
+		GPIOR0 = static_cast<uint8_t>(m_id | PROBE_END);
+		asm volatile ("" ::: "memory");
+	}
+
+	probe_span(const probe_span&) = delete;
+	probe_span& operator = (const probe_span&) = delete;
+
+private:
+	const uint8_t m_id;
+};
+
+#define PROBE_CONCAT_(a, b) a##b
+#define PROBE_CONCAT(a, b) PROBE_CONCAT_(a, b)
+#define PROBE_SPAN(id) probe_span PROBE_CONCAT(probe_span_, __LINE__){id}
+
+#else
+
+#define PROBE_SPAN(id)
+
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef SCAN_ENGINE_H
+#define SCAN_ENGINE_H
+
+/*
+  LEDのスキャンエンジン
+
+  7セグとバー(74HC595でないとき)のピンの出力を、スロットごとのポートB、C、Dの像(フレームバッファ)に
+  まとめて持つ。表示を変えるときは像のビットを書き換えるだけで、ポートには書かない。
+  タイマ割り込みでは今のスロットの像を3つのポートに書くだけなので、何を表示していても
+  割り込みの処理は同じ(読み書き3回ずつ、分岐なし)。
+
+  スロットの順番はコンパイル時に決める。TicksPerSlotティックごとに次のスロットへ進み、
+  Slotsスロットで一周する。ダイナミック点灯の桁がスロットにあたり、どの桁でも同じバーは
+  全スロットに書いておく。
+  登録(claim)していないビット(スイッチのプルアップ、74HC595のRCLKなど)は書き換えない。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+
+// ポートB、C、Dに書く値
+struct port_image
+{
+	uint8_t b;
+	uint8_t c;
+	uint8_t d;
+};
+
+// スキャンエンジンが出力するピン。ポートには書かず、像の中のビットを変える
+class scan_pin
+{
+public:
+	scan_pin(volatile uint8_t* port, uint8_t bit) : m_port(port), m_mask(static_cast<uint8_t>(_BV(bit))) {}
+
+	void set(port_image& image) const {
+		byte_of(image) = static_cast<uint8_t>(byte_of(image) | m_mask);
+	}
+
+	void reset(port_image& image) const {
+		byte_of(image) = static_cast<uint8_t>(byte_of(image) & ~m_mask);
+	}
+
+	void write(port_image& image, bool level) const {
+		if (level) {
+			set(image);
+		} else {
+			reset(image);
+		}
+	}
+
+private:
+	// PORTB、PORTC、PORTD以外のピンは作らないこと
+	uint8_t& byte_of(port_image& image) const {
+		if (m_port == &PORTB) return image.b;
+		if (m_port == &PORTC) return image.c;
+		return image.d;
+	}
+
+	volatile uint8_t* m_port;
+	uint8_t m_mask;
+};
+
+template <uint8_t Slots, uint8_t TicksPerSlot>
+class scan_engine
+{
+	static_assert(Slots >= 1 && (Slots & (Slots - 1)) == 0, "slots must be a power of 2.");
+	static_assert(TicksPerSlot >= 1 && (TicksPerSlot & (TicksPerSlot - 1)) == 0, "ticks per slot must be a power of 2.");
+public:
+	static constexpr uint8_t SLOTS = Slots;
+	static constexpr uint8_t TICKS_PER_SLOT = TicksPerSlot;
+
+	// pinをスキャンの対象にする。offは消灯のレベルで、全スロットと消灯用の像に書く
+	void claim(const scan_pin& pin, bool off) {
+		port_image mask {};
+		pin.set(mask);
+		m_keep.b = static_cast<uint8_t>(m_keep.b & ~mask.b);
+		m_keep.c = static_cast<uint8_t>(m_keep.c & ~mask.c);
+		m_keep.d = static_cast<uint8_t>(m_keep.d & ~mask.d);
+		pin.write(m_off, off);
+		write_all(pin, off);
+	}
+
+	port_image& slot(uint8_t index) {
+		return m_slot[index];
+	}
+
+	// 全スロットで同じレベルにする
+	void write_all(const scan_pin& pin, bool level) {
+		for (auto& image : m_slot) {
+			pin.write(image, level);
+		}
+	}
+
+	// タイマ割り込みから毎ティック呼ぶ
+	void update(uint8_t tick) {
+		output(m_slot[(tick / TicksPerSlot) & (Slots - 1)]);
+	}
+
+	// 輝度調整用。次のupdateまで全部消す
+	void blank() {
+		output(m_off);
+	}
+
+	// 今のスロットの像のとおりにピンが読めるか。GNDやVCCにショートしているピンがあればfalse。
+	// updateで出してからしばらく(次のティックの直前まで)たってから呼ぶこと。DIDR0/DIDR1で切ったピンは0が読めるので、
+	// 呼ぶ間はデジタル入力バッファを戻しておく。自己診断(self_test.h)用
+	bool verify(uint8_t tick) const {
+		const port_image& image = m_slot[(tick / TicksPerSlot) & (Slots - 1)];
+		return ((PINB ^ image.b) & ~m_keep.b) == 0 && ((PINC ^ image.c) & ~m_keep.c) == 0 && ((PIND ^ image.d) & ~m_keep.d) == 0;
+	}
+
+private:
+	void output(const port_image& image) {
+		PORTB = static_cast<uint8_t>((PORTB & m_keep.b) | image.b);
+		PORTC = static_cast<uint8_t>((PORTC & m_keep.c) | image.c);
+		PORTD = static_cast<uint8_t>((PORTD & m_keep.d) | image.d);
+	}
+
+	port_image m_slot[Slots] {};
+	port_image m_off {};
+	port_image m_keep {0xFF, 0xFF, 0xFF};    // スキャンの対象でないビット
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef SELF_TEST_H
+#define SELF_TEST_H
+
+/*
+  電源投入時の自己診断(SELF_TEST = 1のとき)
+
+  ウォッチドッグのリセットから再開したとき以外は、割り込みを許可する前にmainから
+  self_test()(avr-hokey.cpp)を呼ぶ。割り込みは使わず、Timer0のOCF0Aを見てティックを数える。
+  全部で200ms以内に終わり、異常がなければそのまま待機状態になる。
+
+    ランプ   7セグのA～Gを1つずつ(両方の桁)、続けてバーのLEDを1つずつ約4msずつ点灯する。
+             点かないLEDは見て確かめる。スキャンエンジンのピンは出した像と同じに読めるかも調べ、
+             GNDやVCCにショートしているピンを見つける(74HC595のバーは読めないので見るだけ)
+    スイッチ 診断の間ずっと押されているスイッチは、押しっぱなし(ショート)とみなす
+    EEPROM   ハイスコアと難易度の値が範囲内か(.eepを書いていないEEPROMの0xFFも異常)
+    タイマ   ウォッチドッグの発振器(約128kHz)の32msの間にTimer0が数えたカウントを、
+             TIMER_HZからの期待値と比べる(±25%)。ヒューズのCKDIV8やCLOCKの選び間違いが分かる
+
+  異常があればself_test_fault状態で、異常コードを2桁で1つずつ表示し、全部を2回表示したら
+  待機状態に戻る。トレースにも残す(trace_event::self_test)。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/wdt.h>
+
+#include "config.h"
+#include "clock_profile.h"
+#include "containers.h"
+
+// 異常コード。7セグにそのまま表示する
+enum class self_test_fault : uint8_t
+{
+	lamp_idle = 10,    // 全部消したときに、読めたピンが違う
+	lamp_segment = 11,    // 11～17: 7セグのA～Gを点けたときに、読めたピンが違う
+	lamp_bar = 20,    // 20～29: バーのLED(0番から)を点けたときに、読めたピンが違う。74HC595のバーは20だけ
+	game_switch = 31,    // 押しっぱなし
+	high_score_switch = 32,
+	erase_switch = 33,
+	high_score_record = 41,    // EEPROMのハイスコアが範囲外
+	difficulty_record = 42,    // EEPROMの難易度が範囲外
+	timer_slow = 51,    // Timer0のクロックが遅い
+	timer_fast = 52,
+};
+
+// 見つかった異常。種類ごとに1つまでなので8個で足りる
+using self_test_report = static_vector<self_test_fault, 8>;
+
+/*
+  Timer0のクロックを、ウォッチドッグの発振器と比べる。割り込みを止めたまま使い、
+  ティック(OCF0A)を数える側がon_tickを、待っている間はpollを呼ぶ。
+  ウォッチドッグはリセットでなく割り込みのモードにして、フラグ(WDIF)だけを見る。
+ */
+class timer_clock_check
+{
+public:
+	// ウォッチドッグの32ms(発振器の4096サイクル)の間のTimer0のカウント数
+	static constexpr uint32_t EXPECTED_COUNTS = TIMER_HZ * 4096 / 128000;
+
+	void start() {
+		WDTCSR = _BV(WDCE) | _BV(WDE);
+		WDTCSR = _BV(WDIF) | _BV(WDIE) | _BV(WDP0);
+		wdt_reset();
+		m_start = TCNT0;
+		m_ticks = 0;
+		m_counts = 0;
+		m_done = false;
+	}
+
+	void on_tick() {
+		++m_ticks;
+	}
+
+	// 測り終わったらtrue。ウォッチドッグは止める(mainでリセットのモードにし直す)。
+	// 期待値の2倍を数えてもウォッチドッグが来なければ、そこで打ち切る(速すぎる)
+	bool poll() {
+		if (m_done) return true;
+		if ((WDTCSR & _BV(WDIF)) != 0) {
+			uint8_t count = TCNT0;
+			uint16_t ticks = m_ticks;
+			// TCNT0を読む前にティックが終わっていて、まだ数えていない
+			if ((TIFR0 & _BV(OCF0A)) != 0 && count < TICK_COUNTS / 2) ++ticks;
+			m_counts = static_cast<uint32_t>(ticks) * TICK_COUNTS + count - m_start;
+		} else if (m_ticks >= TIMEOUT_TICKS) {
+			m_counts = static_cast<uint32_t>(m_ticks) * TICK_COUNTS;
+		} else {
+			return false;
+		}
+		WDTCSR = _BV(WDCE) | _BV(WDE);
+		WDTCSR = _BV(WDIF);
+		m_done = true;
+		return true;
+	}
+
+	// pollがtrueを返したあとで呼ぶ。異常がなければfalse
+	bool fault(self_test_fault& code) const {
+		if (m_counts < EXPECTED_COUNTS * 3 / 4) {
+			code = self_test_fault::timer_slow;
+			return true;
+		}
+		if (m_counts > EXPECTED_COUNTS * 5 / 4) {
+			code = self_test_fault::timer_fast;
+			return true;
+		}
+		return false;
+	}
+
+private:
+	static constexpr uint16_t TIMEOUT_TICKS = EXPECTED_COUNTS * 2 / TICK_COUNTS + 1;
+
+	uint32_t m_counts = 0;
+	uint16_t m_ticks = 0;
+	uint8_t m_start = 0;
+	bool m_done = false;
+};
+
+#endif
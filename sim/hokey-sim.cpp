@@ -0,0 +1,910 @@
+/*
+  hokey-sim: simavrでavr-hokeyを動かすためのハーネス
+
+  使い方
+    hokey-sim [オプション] avr-hokey.elf
+
+    -t SEC          SEC秒(実時間換算)で終了する。既定は10秒
+    -s PIN@MS:LEN   PIN(例: B1)につないだスイッチをMSミリ秒からLENミリ秒押す。複数指定可
+    -u FILE         UARTの送信データをFILEに書き出す
+    -p              UARTを擬似端末につなぐ。端末のパスを標準エラーに表示する
+    -l LINK         UARTをもう1つのhokey-simとつなぐ(VERSUS)。LINKがなければ擬似端末を作って
+                    LINKをそのシンボリックリンクにし(終了時に消す)、あればそれを開く。
+                    同じLINKを指定して2つ起動すれば対戦できる。-rと一緒に使うこと
+    -j MS           受信したバイトをMSミリ秒(実機の時刻)遅らせてAVRに渡す。通信の遅れの再現用
+    -r              実時間に合わせて動かす(速すぎるときは待つ)
+    -d              UARTの送信データをテレメトリとして解読して表示する
+    -B FILE         ブートローダのELFを読み込み、ブートセクションから起動する
+                    外部リセットからの起動として扱うので、ブートローダはSYNCを待つ
+    -b              74HC595のLEDバー(BAR_SPI_LENGTH)を監視し、表示が変わるたびに位置と
+                    1回の転送にかかった時間(最初のSPDR書き込みからRCLKの立ち上がりまで)を表示する
+    -T              終了時にイベントトレース(trace_buffer)を古い順に表示する
+                    TRACE_DEPTHを0以外にしてビルドしたファームウェアが必要
+    -L PERCENT      終了時に状態ごとのCPU負荷(スリープしていないサイクルの割合)と、
+                    1ティックでいちばん長く起きていた割合を表示する。
+                    どれかの状態の負荷がPERCENTを超えていたら終了コード2で終わる
+    -P              終了時にプローブの区間(probe.h)ごとのサイクル数の分布と、入れ子ごとの集計を表示する
+                    PROBE = 1でビルドしたファームウェアが必要
+    -F FILE         プローブの区間の入れ子ごとのサイクル数を、flamegraph.plに渡せる形式でFILEに書き出す
+    -S              電源投入時の自己診断(SELF_TEST)が異常を見つけたら(self_test_fault状態になったら)、
+                    そこで終了コード3で終わる。正常な基板で自己診断が通ることの確認用
+
+  simavrはCLKPRによるクロックの分周を再現しないので、CLKPRへの書き込みを監視して
+  サイクル数から実時間を計算している(時刻はすべて実機での時刻に換算したもの)。
+  デジタル入力バッファ(DIDR0, DIDR1)も再現しないので、PINC, PINDの読み出しに割り込んで
+  切ったピンを0にする。
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pty.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <gelf.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "sim_io.h"
+#include "avr_uart.h"
+#include "avr_ioport.h"
+#include "avr_spi.h"
+
+#include "telemetry_protocol.h"
+#include "trace.h"
+#include "probe.h"
+
+namespace
+{
+	// board.mkのMCUとF_CPU。-mと-fで変える
+	const char* mcu = "atmega88";
+	uint32_t cpu_hz = 8000000;
+	constexpr avr_io_addr_t CLKPR_ADDR = 0x61;
+	constexpr avr_io_addr_t MCUSR_ADDR = 0x54;
+	constexpr avr_io_addr_t GPIOR0_ADDR = 0x3E;
+	constexpr avr_io_addr_t GPIOR1_ADDR = 0x4A;
+	constexpr avr_io_addr_t TCCR0B_ADDR = 0x45;
+	constexpr avr_io_addr_t OCR0A_ADDR = 0x47;
+	constexpr avr_io_addr_t PINC_ADDR = 0x26;
+	constexpr avr_io_addr_t PIND_ADDR = 0x29;
+	constexpr avr_io_addr_t DIDR0_ADDR = 0x7E;
+	constexpr avr_io_addr_t DIDR1_ADDR = 0x7F;
+	constexpr uint8_t EXTRF = 0x02;
+	constexpr uint32_t DATA_OFFSET = 0x800000;    // ELFでのデータ空間のアドレス
+
+	// 1ティックの長さ。FAST_TICKかどうかはOCR0Aで、Timer0のクロックはTCCR0BとCLKPRで分かる
+	double ms_per_tick(const avr_t* avr)
+	{
+		static const int prescalers[8] {0, 1, 8, 64, 256, 1024, 0, 0};
+		uint32_t divisor = static_cast<uint32_t>(prescalers[avr->data[TCCR0B_ADDR] & 0x07]) << (avr->data[CLKPR_ADDR] & 0x0F);
+		return (avr->data[OCR0A_ADDR] + 1) * static_cast<double>(divisor) * 1000 / cpu_hz;
+	}
+
+	// CLKPRを考慮した実時間
+	class sim_clock
+	{
+	public:
+		void attach(avr_t* avr) {
+			m_avr = avr;
+			avr_register_io_write(avr, CLKPR_ADDR, &sim_clock::on_clkpr_write, this);
+		}
+
+		uint64_t now_ns() const {
+			return m_base_ns + (m_avr->cycle - m_base_cycle) * m_divisor * 1000 / (cpu_hz / 1000000);
+		}
+
+	private:
+		static void on_clkpr_write(avr_t* avr, avr_io_addr_t addr, uint8_t v, void* param) {
+			sim_clock* self = static_cast<sim_clock*>(param);
+			avr->data[addr] = v;
+			if (v & 0x80) return;    // CLKPCEの書き込み
+			self->m_base_ns = self->now_ns();
+			self->m_base_cycle = avr->cycle;
+			self->m_divisor = 1u << (v & 0x0F);
+		}
+
+		avr_t* m_avr = nullptr;
+		uint64_t m_base_ns = 0;
+		avr_cycle_count_t m_base_cycle = 0;
+		uint32_t m_divisor = 1;
+	};
+
+	/*
+	  デジタル入力バッファを切ったピン(DIDR0のPC0～PC5、DIDR1のPD6, PD7)を0と読ませる。
+	  PINの読み出しはavr_ioportが持っているので、その読み出し関数を包む
+	 */
+	class digital_input_disable
+	{
+	public:
+		void attach(avr_t* avr) {
+			wrap(avr, PINC_ADDR, &digital_input_disable::read_pinc, m_pinc);
+			wrap(avr, PIND_ADDR, &digital_input_disable::read_pind, m_pind);
+		}
+
+	private:
+		struct reader
+		{
+			avr_io_read_t c = nullptr;
+			void* param = nullptr;
+
+			uint8_t read(avr_t* avr, avr_io_addr_t addr) const {
+				return c ? c(avr, addr, param) : avr->data[addr];
+			}
+		};
+
+		void wrap(avr_t* avr, avr_io_addr_t addr, avr_io_read_t c, reader& original) {
+			auto& io = avr->io[AVR_DATA_TO_IO(addr)].r;
+			original.c = io.c;
+			original.param = io.param;
+			io.c = c;
+			io.param = this;
+		}
+
+		static uint8_t read_pinc(avr_t* avr, avr_io_addr_t addr, void* param) {
+			const digital_input_disable* self = static_cast<const digital_input_disable*>(param);
+			return static_cast<uint8_t>(self->m_pinc.read(avr, addr) & ~(avr->data[DIDR0_ADDR] & 0x3F));
+		}
+
+		static uint8_t read_pind(avr_t* avr, avr_io_addr_t addr, void* param) {
+			const digital_input_disable* self = static_cast<const digital_input_disable*>(param);
+			return static_cast<uint8_t>(self->m_pind.read(avr, addr) & ~((avr->data[DIDR1_ADDR] & 0x03) << 6));
+		}
+
+		reader m_pinc;
+		reader m_pind;
+	};
+
+	// スイッチ操作のスクリプト
+	struct switch_press
+	{
+		char port;
+		int bit;
+		uint64_t start_ns;
+		uint64_t end_ns;
+		bool pressed;
+	};
+
+	class switch_script
+	{
+	public:
+		bool add(const char* spec) {
+			switch_press p{};
+			unsigned start_ms, length_ms;
+			if (sscanf(spec, "%c%d@%u:%u", &p.port, &p.bit, &start_ms, &length_ms) != 4) return false;
+			if (p.port < 'B' || p.port > 'D' || p.bit < 0 || p.bit > 7) return false;
+			p.start_ns = start_ms * 1000000ull;
+			p.end_ns = p.start_ns + length_ms * 1000000ull;
+			m_presses.push_back(p);
+			return true;
+		}
+
+		// スイッチはプルアップなので、離した状態(High)にしておく
+		void attach(avr_t* avr) {
+			m_avr = avr;
+			for (const auto& p : m_presses) {
+				set(p, 1);
+			}
+		}
+
+		void update(uint64_t now_ns) {
+			for (auto& p : m_presses) {
+				if (!p.pressed && now_ns >= p.start_ns && now_ns < p.end_ns) {
+					p.pressed = true;
+					set(p, 0);
+				} else if (p.pressed && now_ns >= p.end_ns) {
+					p.pressed = false;
+					set(p, 1);
+				}
+			}
+		}
+
+	private:
+		void set(const switch_press& p, uint32_t level) {
+			avr_raise_irq(avr_io_getirq(m_avr, AVR_IOCTL_IOPORT_GETIRQ(p.port), p.bit), level);
+		}
+
+		avr_t* m_avr = nullptr;
+		std::vector<switch_press> m_presses;
+	};
+
+	// テレメトリの解読
+	class telemetry_decoder
+	{
+	public:
+		void feed(uint8_t byte, uint64_t now_ns) {
+			if (m_size == 0 && byte != telemetry_protocol::SYNC) return;
+			m_record[m_size++] = byte;
+			if (m_size < telemetry_protocol::HEADER_SIZE + 1) return;
+			uint8_t length = m_record[1];
+			auto type = static_cast<telemetry_protocol::record_type>(m_record[2]);
+			if (length == 0 || telemetry_protocol::payload_size(type) != length - 1) {
+				printf("%10.3f ms  broken record\n", static_cast<double>(now_ns) / 1e6);
+				m_size = 0;
+				return;
+			}
+			if (m_size < telemetry_protocol::HEADER_SIZE + length) return;
+			print(type, m_record + telemetry_protocol::HEADER_SIZE + 1, now_ns);
+			m_size = 0;
+		}
+
+	private:
+		static void print(telemetry_protocol::record_type type, const uint8_t* p, uint64_t now_ns) {
+			printf("%10.3f ms  ", static_cast<double>(now_ns) / 1e6);
+			switch (type) {
+			case telemetry_protocol::record_type::game_start:
+				printf("game_start\n");
+				break;
+			case telemetry_protocol::record_type::hit:
+				printf("hit         score=%u offset=%u speed=%u\n", p[0], p[1], p[2]);
+				break;
+			case telemetry_protocol::record_type::game_over:
+				printf("game_over   score=%u speed=%u\n", p[0], p[1]);
+				break;
+			case telemetry_protocol::record_type::high_score:
+				printf("high_score  score=%u\n", p[0]);
+				break;
+			case telemetry_protocol::record_type::ack:
+				printf("ack         command=%u result=%u\n", p[0], p[1]);
+				break;
+			case telemetry_protocol::record_type::status:
+				printf("status      high_score=%u difficulty=%u state=%u games=%u hits=%u\n", p[0], p[1], p[2], p[3] | p[4] << 8, p[5] | p[6] << 8);
+				break;
+			case telemetry_protocol::record_type::trace:
+				printf("trace       time=%u event=%u arg=%u\n", p[0] | p[1] << 8, p[2], p[3]);
+				break;
+			}
+		}
+
+		uint8_t m_record[telemetry_protocol::HEADER_SIZE + 256];
+		int m_size = 0;
+	};
+
+	// UARTの入出力
+	class uart_bridge
+	{
+	public:
+		void attach(avr_t* avr, sim_clock* clock) {
+			m_avr = avr;
+			m_clock = clock;
+			// simavrが送信データを標準出力に出さないようにする
+			uint32_t flags = 0;
+			avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+			flags &= ~AVR_UART_FLAG_STDIO;
+			avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+			avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT), &uart_bridge::on_output, this);
+			avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUT_XON), &uart_bridge::on_xon, this);
+			avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUT_XOFF), &uart_bridge::on_xoff, this);
+		}
+
+		bool open_file(const char* path) {
+			m_file = fopen(path, "wb");
+			return m_file != nullptr;
+		}
+
+		bool open_pty() {
+			int slave;
+			char name[256];
+			if (openpty(&m_pty, &slave, name, nullptr, nullptr) < 0) return false;
+			fcntl(m_pty, F_SETFL, fcntl(m_pty, F_GETFL) | O_NONBLOCK);
+			fprintf(stderr, "UART: %s\n", name);
+			return true;
+		}
+
+		// もう1つのhokey-simとつなぐ。先に起動した側が擬似端末を作り、後から起動した側がそれを開く。
+		// 端末はrawにする(エコーや改行の変換があるとバイト列が変わる)
+		bool open_link(const char* path) {
+			struct stat st;
+			if (lstat(path, &st) == 0) {
+				m_pty = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+				if (m_pty < 0) return false;
+				struct termios raw;
+				if (tcgetattr(m_pty, &raw) == 0) {
+					cfmakeraw(&raw);
+					tcsetattr(m_pty, TCSANOW, &raw);
+				}
+				fprintf(stderr, "UART: linked to %s\n", path);
+				return true;
+			}
+			struct termios raw{};
+			cfmakeraw(&raw);
+			char name[256];
+			// 相手が開くまで、スレーブ側を開いたままにしておく(閉じているとマスタへの書き込みがEIOになる)
+			if (openpty(&m_pty, &m_link_slave, name, &raw, nullptr) < 0) return false;
+			fcntl(m_pty, F_SETFL, fcntl(m_pty, F_GETFL) | O_NONBLOCK);
+			if (symlink(name, path) < 0) return false;
+			m_link_path = path;
+			fprintf(stderr, "UART: %s -> %s\n", path, name);
+			return true;
+		}
+
+		void close_link() {
+			if (!m_link_path.empty()) {
+				unlink(m_link_path.c_str());
+				m_link_path.clear();
+			}
+		}
+
+		void set_delay(uint64_t delay_ns) {
+			m_delay_ns = delay_ns;
+		}
+
+		void enable_decoder() {
+			m_decode = true;
+		}
+
+		// 擬似端末から来たデータをAVRに渡す。-jのときは受け取った時刻から遅らせる
+		void poll() {
+			if (m_pty < 0) return;
+			uint64_t now = m_clock->now_ns();
+			uint8_t byte;
+			if (read(m_pty, &byte, 1) == 1) {
+				m_received.push_back({now + m_delay_ns, byte});
+			}
+			if (!m_xon || m_received.empty() || m_received.front().first > now) return;
+			avr_raise_irq(avr_io_getirq(m_avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT), m_received.front().second);
+			m_received.pop_front();
+		}
+
+	private:
+		static void on_output(avr_irq_t*, uint32_t value, void* param) {
+			uart_bridge* self = static_cast<uart_bridge*>(param);
+			uint8_t byte = static_cast<uint8_t>(value);
+			if (self->m_file) {
+				fputc(byte, self->m_file);
+			}
+			if (self->m_pty >= 0) {
+				ssize_t written = write(self->m_pty, &byte, 1);
+				(void)written;
+			}
+			if (self->m_decode) {
+				self->m_decoder.feed(byte, self->m_clock->now_ns());
+			}
+		}
+
+		static void on_xon(avr_irq_t*, uint32_t, void* param) {
+			static_cast<uart_bridge*>(param)->m_xon = true;
+		}
+
+		static void on_xoff(avr_irq_t*, uint32_t, void* param) {
+			static_cast<uart_bridge*>(param)->m_xon = false;
+		}
+
+		avr_t* m_avr = nullptr;
+		sim_clock* m_clock = nullptr;
+		FILE* m_file = nullptr;
+		int m_pty = -1;
+		int m_link_slave = -1;
+		std::string m_link_path;
+		uint64_t m_delay_ns = 0;
+		std::deque<std::pair<uint64_t, uint8_t>> m_received;    // AVRに渡す時刻とバイト
+		bool m_xon = true;
+		bool m_decode = false;
+		telemetry_decoder m_decoder;
+	};
+
+	// 74HC595のLEDバーの監視。bar_spi.hの配線を前提にする
+	class spi_bar_monitor
+	{
+	public:
+		void attach(avr_t* avr, sim_clock* clock) {
+			m_clock = clock;
+			avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ('0'), SPI_IRQ_OUTPUT), &spi_bar_monitor::on_byte, this);
+			avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 2), &spi_bar_monitor::on_latch, this);
+		}
+
+		void print_summary() const {
+			printf("spi bar: %lu latches, max burst %.2f us\n", m_latches, static_cast<double>(m_max_burst_ns) / 1e3);
+		}
+
+	private:
+		static void on_byte(avr_irq_t*, uint32_t value, void* param) {
+			spi_bar_monitor* self = static_cast<spi_bar_monitor*>(param);
+			if (self->m_bytes.empty()) {
+				self->m_first_ns = self->m_clock->now_ns();
+			}
+			self->m_bytes.push_back(static_cast<uint8_t>(value));
+		}
+
+		static void on_latch(avr_irq_t*, uint32_t value, void* param) {
+			spi_bar_monitor* self = static_cast<spi_bar_monitor*>(param);
+			if (value == 0 || self->m_bytes.empty()) return;
+			uint64_t now = self->m_clock->now_ns();
+			uint64_t burst = now - self->m_first_ns;
+			if (burst > self->m_max_burst_ns) self->m_max_burst_ns = burst;
+			++self->m_latches;
+			// 最後に送ったバイトが1個目の74HC595(LED 0～7)
+			std::vector<int> lit;
+			size_t count = self->m_bytes.size();
+			for (size_t chip = 0; chip < count; ++chip) {
+				uint8_t data = self->m_bytes[count - 1 - chip];
+				for (int bit = 0; bit < 8; ++bit) {
+					if ((data & (1 << bit)) == 0) lit.push_back(static_cast<int>(chip * 8) + bit);
+				}
+			}
+			if (lit != self->m_lit) {
+				printf("%10.3f ms  bar", static_cast<double>(now) / 1e6);
+				for (int i : lit) printf(" %d", i);
+				printf("%s  (%zu bytes, %.2f us)\n", lit.empty() ? " off" : "", count, static_cast<double>(burst) / 1e3);
+				self->m_lit = lit;
+			}
+			self->m_bytes.clear();
+		}
+
+		sim_clock* m_clock = nullptr;
+		std::vector<uint8_t> m_bytes;
+		std::vector<int> m_lit;
+		uint64_t m_first_ns = 0;
+		uint64_t m_max_burst_ns = 0;
+		unsigned long m_latches = 0;
+	};
+
+	// 状態ごとのCPU負荷。ファームウェアはchange_stateでGPIOR1に状態(game_state)を書く
+	// avr_runの1回分のサイクルを、呼ぶ前に起きていれば忙しかったものとして、そのときの状態に数える。
+	// 一度でも入った状態も覚えておく(-S)
+	class load_meter
+	{
+	public:
+		static constexpr uint8_t SELF_TEST_FAULT = 6;    // game_state::self_test_fault
+
+		void attach(avr_t* avr) {
+			m_avr = avr;
+			avr_register_io_write(avr, GPIOR1_ADDR, &load_meter::on_state, this);
+		}
+
+		void before_run() {
+			if (!m_avr) return;
+			m_cycle = m_avr->cycle;
+			m_running = m_avr->state == cpu_Running;
+		}
+
+		void after_run() {
+			if (!m_avr) return;
+			state_load& s = m_states[m_state];
+			uint64_t cycles = m_avr->cycle - m_cycle;
+			s.total += cycles;
+			if (!m_running) return;
+			s.busy += cycles;
+			m_awake += cycles;
+			if (m_avr->state != cpu_Sleeping) return;
+			// 起きてから寝るまでを、今のTimer0の設定での1ティックのサイクル数と比べる
+			double tick = cycles_per_tick();
+			if (tick > 0 && m_awake / tick > s.peak) s.peak = m_awake / tick;
+			m_awake = 0;
+		}
+
+		bool entered(uint8_t state) const {
+			return (m_entered & (1u << state)) != 0;
+		}
+
+		// 負荷がbudget(%)を超えた状態があればfalse
+		bool print_summary(double budget) const {
+			static const char* const names[STATES] {
+				"ready_to_start", "show_high_score", "playing", "show_score_blink", "show_score", "diagnostics",
+				"self_test_fault", "versus_waiting", "versus_playing",
+			};
+			bool ok = true;
+			printf("cpu load (budget %.1f%%)\n", budget);
+			for (int i = 0; i < STATES; ++i) {
+				const state_load& s = m_states[i];
+				if (s.total == 0) continue;
+				double load = 100.0 * static_cast<double>(s.busy) / static_cast<double>(s.total);
+				bool over = load > budget;
+				printf("  %-16s load %5.1f%%  peak tick %5.1f%%%s\n", names[i], load, s.peak * 100, over ? "  OVER BUDGET" : "");
+				if (over) ok = false;
+			}
+			return ok;
+		}
+
+	private:
+		static constexpr int STATES = 9;    // game_stateの数。namesはgame_stateと同じ順番
+
+		struct state_load
+		{
+			uint64_t busy = 0;
+			uint64_t total = 0;
+			double peak = 0;
+		};
+
+		static void on_state(avr_t* avr, avr_io_addr_t addr, uint8_t v, void* param) {
+			load_meter* self = static_cast<load_meter*>(param);
+			avr->data[addr] = v;
+			if (v < STATES) {
+				self->m_state = v;
+				self->m_entered |= 1u << v;
+			}
+		}
+
+		double cycles_per_tick() const {
+			static const int prescalers[8] {0, 1, 8, 64, 256, 1024, 0, 0};
+			return static_cast<double>((m_avr->data[OCR0A_ADDR] + 1) * prescalers[m_avr->data[TCCR0B_ADDR] & 0x07]);
+		}
+
+		avr_t* m_avr = nullptr;
+		state_load m_states[STATES];
+		uint8_t m_state = 0;
+		uint16_t m_entered = 1;    // 最初はready_to_start
+		uint64_t m_cycle = 0;
+		bool m_running = true;
+		double m_awake = 0;
+	};
+
+	// プローブの区間。GPIOR0への書き込みを区間の出入りとして、入れ子をたどってサイクル数を数える
+	class probe_monitor
+	{
+	public:
+		void attach(avr_t* avr) {
+			m_avr = avr;
+			avr_register_io_write(avr, GPIOR0_ADDR, &probe_monitor::on_write, this);
+		}
+
+		void print_summary() const {
+			printf("probe spans (cycles)\n");
+			for (int id = 1; id < SPAN_IDS; ++id) {
+				const span_stats& s = m_spans[id];
+				if (s.count == 0) continue;
+				printf("  %-14s calls %8llu  min %6llu  avg %8.1f  max %6llu\n", probe_name(static_cast<uint8_t>(id)),
+					static_cast<unsigned long long>(s.count), static_cast<unsigned long long>(s.min),
+					static_cast<double>(s.total) / static_cast<double>(s.count), static_cast<unsigned long long>(s.max));
+				uint64_t peak = 0;
+				for (uint64_t n : s.buckets) {
+					if (n > peak) peak = n;
+				}
+				for (int b = 0; b < BUCKETS; ++b) {
+					if (s.buckets[b] == 0) continue;
+					int width = static_cast<int>(s.buckets[b] * 40 / peak);
+					printf("    %6llu-%-6llu %8llu %.*s\n", 1ull << b, (2ull << b) - 1,
+						static_cast<unsigned long long>(s.buckets[b]), width > 0 ? width : 1, "########################################");
+				}
+			}
+			// 入れ子ごとの集計。selfは子の区間を除いたサイクル数
+			uint64_t all = 0;
+			for (const auto& f : m_folded) all += f.second.self;
+			printf("probe stacks (self cycles)\n");
+			for (const auto& f : m_folded) {
+				printf("  %5.1f%%  %10llu  %8llu calls  %s\n", all ? 100.0 * static_cast<double>(f.second.self) / static_cast<double>(all) : 0.0,
+					static_cast<unsigned long long>(f.second.self), static_cast<unsigned long long>(f.second.count), f.first.c_str());
+			}
+			if (m_broken) {
+				printf("  %lu unmatched span ends\n", m_broken);
+			}
+		}
+
+		bool write_folded(const char* path) const {
+			FILE* file = fopen(path, "w");
+			if (!file) return false;
+			for (const auto& f : m_folded) {
+				fprintf(file, "%s %llu\n", f.first.c_str(), static_cast<unsigned long long>(f.second.self));
+			}
+			return fclose(file) == 0;
+		}
+
+	private:
+		static constexpr int SPAN_IDS = 128;
+		static constexpr int BUCKETS = 20;    // 2の累乗ごと。最後は2^19サイクル以上
+
+		struct frame
+		{
+			uint8_t id;
+			uint64_t start;
+			uint64_t children;    // 子の区間のサイクル数の合計
+		};
+
+		struct span_stats
+		{
+			uint64_t count = 0;
+			uint64_t total = 0;
+			uint64_t min = ~0ull;
+			uint64_t max = 0;
+			uint64_t buckets[BUCKETS] = {};
+		};
+
+		struct folded_stack
+		{
+			uint64_t self = 0;
+			uint64_t count = 0;
+		};
+
+		static void on_write(avr_t* avr, avr_io_addr_t addr, uint8_t v, void* param) {
+			probe_monitor* self = static_cast<probe_monitor*>(param);
+			avr->data[addr] = v;
+			if (v & PROBE_END) {
+				self->end(static_cast<uint8_t>(v & ~PROBE_END));
+			} else if (v != 0) {
+				self->m_stack.push_back({v, avr->cycle, 0});
+			}
+		}
+
+		void end(uint8_t id) {
+			// 対応する開始が見つからない終わりは数えるだけ。途中の区間は閉じ忘れとして捨てる
+			size_t depth = m_stack.size();
+			while (depth > 0 && m_stack[depth - 1].id != id) --depth;
+			if (depth == 0) {
+				++m_broken;
+				return;
+			}
+			m_stack.resize(depth);
+			const frame f = m_stack.back();
+			uint64_t cycles = m_avr->cycle - f.start;
+			span_stats& s = m_spans[id];
+			++s.count;
+			s.total += cycles;
+			if (cycles < s.min) s.min = cycles;
+			if (cycles > s.max) s.max = cycles;
+			int bucket = 0;
+			while (bucket < BUCKETS - 1 && (2ull << bucket) <= cycles) ++bucket;
+			++s.buckets[bucket];
+
+			std::string path;
+			for (const frame& p : m_stack) {
+				if (!path.empty()) path += ';';
+				path += probe_name(p.id);
+			}
+			folded_stack& folded = m_folded[path];
+			folded.self += cycles - f.children;
+			++folded.count;
+			m_stack.pop_back();
+			if (!m_stack.empty()) m_stack.back().children += cycles;
+		}
+
+		avr_t* m_avr = nullptr;
+		std::vector<frame> m_stack;
+		span_stats m_spans[SPAN_IDS];
+		std::map<std::string, folded_stack> m_folded;
+		unsigned long m_broken = 0;
+	};
+
+	// ELFのシンボル表からデータ空間の変数を探す
+	bool find_symbol(const char* path, const char* name, uint32_t& address, uint32_t& size)
+	{
+		if (elf_version(EV_CURRENT) == EV_NONE) return false;
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) return false;
+		Elf* elf = elf_begin(fd, ELF_C_READ, nullptr);
+		bool found = false;
+		Elf_Scn* scn = nullptr;
+		while (elf && !found && (scn = elf_nextscn(elf, scn)) != nullptr) {
+			GElf_Shdr shdr;
+			if (!gelf_getshdr(scn, &shdr) || shdr.sh_type != SHT_SYMTAB) continue;
+			Elf_Data* data = elf_getdata(scn, nullptr);
+			size_t count = shdr.sh_entsize ? shdr.sh_size / shdr.sh_entsize : 0;
+			for (size_t i = 0; data && i < count; ++i) {
+				GElf_Sym sym;
+				if (!gelf_getsym(data, static_cast<int>(i), &sym)) continue;
+				const char* sym_name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+				if (sym_name && strcmp(sym_name, name) == 0 && sym.st_value >= DATA_OFFSET) {
+					address = static_cast<uint32_t>(sym.st_value - DATA_OFFSET);
+					size = static_cast<uint32_t>(sym.st_size);
+					found = true;
+					break;
+				}
+			}
+		}
+		if (elf) elf_end(elf);
+		close(fd);
+		return found;
+	}
+
+	// trace_buffer(trace.hのtrace_ring)をSRAMから読んで表示する
+	bool dump_trace(const char* path, const avr_t* avr)
+	{
+		uint32_t address, size;
+		if (!find_symbol(path, "trace_buffer", address, size) || size < sizeof(trace_record) + 1) {
+			fprintf(stderr, "%s: no trace_buffer (build with TRACE_DEPTH)\n", path);
+			return false;
+		}
+		uint32_t depth = (size - 1) / sizeof(trace_record);
+		uint8_t head = avr->data[address + depth * sizeof(trace_record)];
+		printf("trace (%u records, oldest first)\n", depth);
+		for (uint32_t i = 0; i < depth; ++i) {
+			const uint8_t* p = &avr->data[address + (head + i) % depth * sizeof(trace_record)];
+			auto event = static_cast<trace_event>(p[2]);
+			if (event == trace_event::none) continue;
+			uint16_t time = static_cast<uint16_t>(p[0] | p[1] << 8);
+			printf("%6u tick %10.3f ms  %-12s %u\n", time, time * ms_per_tick(avr), trace_event_name(event), p[3]);
+		}
+		return true;
+	}
+
+	void usage()
+	{
+		fprintf(stderr, "usage: hokey-sim [-t sec] [-s PIN@MS:LEN]... [-u file] [-p] [-l link] [-j ms] [-r] [-d] [-b] [-T] [-L percent] [-P] [-F file] [-B bootloader.elf] [-m mcu] [-f hz] firmware.elf\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	double run_sec = 10.0;
+	switch_script switches;
+	uart_bridge uart;
+	bool use_pty = false;
+	const char* link_path = nullptr;
+	bool real_time = false;
+	const char* bootloader = nullptr;
+	bool show_trace = false;
+	bool watch_spi_bar = false;
+	spi_bar_monitor spi_bar;
+	double load_budget = -1;
+	bool check_self_test = false;
+	load_meter load;
+	bool show_probes = false;
+	const char* folded_path = nullptr;
+	probe_monitor probes;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:s:u:pl:j:rdbTL:PSF:B:m:f:")) != -1) {
+		switch (opt) {
+		case 't':
+			run_sec = atof(optarg);
+			break;
+		case 's':
+			if (!switches.add(optarg)) usage();
+			break;
+		case 'u':
+			if (!uart.open_file(optarg)) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			use_pty = true;
+			break;
+		case 'l':
+			link_path = optarg;
+			break;
+		case 'j':
+			uart.set_delay(static_cast<uint64_t>(atof(optarg) * 1e6));
+			break;
+		case 'r':
+			real_time = true;
+			break;
+		case 'd':
+			uart.enable_decoder();
+			break;
+		case 'b':
+			watch_spi_bar = true;
+			break;
+		case 'T':
+			show_trace = true;
+			break;
+		case 'L':
+			load_budget = atof(optarg);
+			break;
+		case 'P':
+			show_probes = true;
+			break;
+		case 'S':
+			check_self_test = true;
+			break;
+		case 'F':
+			folded_path = optarg;
+			break;
+		case 'B':
+			bootloader = optarg;
+			break;
+		case 'm':
+			mcu = optarg;
+			break;
+		case 'f':
+			cpu_hz = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+			if (cpu_hz < 1000000) usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind + 1 != argc) usage();
+
+	elf_firmware_t firmware{};
+	if (elf_read_firmware(argv[optind], &firmware) != 0) {
+		fprintf(stderr, "%s: cannot read firmware\n", argv[optind]);
+		return 1;
+	}
+	if (firmware.mmcu[0] == '\0') {
+		strncpy(firmware.mmcu, mcu, sizeof(firmware.mmcu) - 1);
+	}
+	firmware.frequency = cpu_hz;
+
+	avr_t* avr = avr_make_mcu_by_name(firmware.mmcu);
+	if (!avr) {
+		fprintf(stderr, "%s: unknown MCU\n", firmware.mmcu);
+		return 1;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &firmware);
+	if (bootloader) {
+		elf_firmware_t boot{};
+		if (elf_read_firmware(bootloader, &boot) != 0) {
+			fprintf(stderr, "%s: cannot read bootloader\n", bootloader);
+			return 1;
+		}
+		avr_loadcode(avr, boot.flash, boot.flashsize, boot.flashbase);
+		// BOOTRSTを設定した状態を再現する
+		avr->reset_pc = boot.flashbase;
+		avr->pc = boot.flashbase;
+		avr->data[MCUSR_ADDR] |= EXTRF;
+	}
+
+	sim_clock clock;
+	clock.attach(avr);
+	digital_input_disable digital_inputs;
+	digital_inputs.attach(avr);
+	switches.attach(avr);
+	uart.attach(avr, &clock);
+	if (use_pty && !uart.open_pty()) {
+		perror("openpty");
+		return 1;
+	}
+	if (link_path && !uart.open_link(link_path)) {
+		perror(link_path);
+		uart.close_link();
+		return 1;
+	}
+	if (watch_spi_bar) {
+		spi_bar.attach(avr, &clock);
+	}
+	if (load_budget >= 0 || check_self_test) {
+		load.attach(avr);
+	}
+	if (show_probes || folded_path) {
+		probes.attach(avr);
+	}
+
+	const uint64_t end_ns = static_cast<uint64_t>(run_sec * 1e9);
+	struct timespec wall_start;
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+	unsigned pace_count = 0;
+	int state = cpu_Running;
+	while (state != cpu_Done && state != cpu_Crashed) {
+		uint64_t now = clock.now_ns();
+		if (now >= end_ns) break;
+		// 実時間より1ms以上進んでいたら待つ。時刻を見るのは数千命令に1回でよい
+		if (real_time && ++pace_count % 4096 == 0) {
+			struct timespec wall;
+			clock_gettime(CLOCK_MONOTONIC, &wall);
+			uint64_t wall_ns = static_cast<uint64_t>(wall.tv_sec - wall_start.tv_sec) * 1000000000ull + static_cast<uint64_t>(wall.tv_nsec) - static_cast<uint64_t>(wall_start.tv_nsec);
+			if (now > wall_ns + 1000000) {
+				usleep(static_cast<useconds_t>((now - wall_ns) / 1000));
+			}
+		}
+		switches.update(now);
+		uart.poll();
+		load.before_run();
+		state = avr_run(avr);
+		load.after_run();
+		if (check_self_test && load.entered(load_meter::SELF_TEST_FAULT)) break;
+	}
+	uart.close_link();
+	if (state == cpu_Crashed) {
+		fprintf(stderr, "AVR crashed at pc=0x%04x\n", avr->pc);
+	}
+	if (watch_spi_bar) {
+		spi_bar.print_summary();
+	}
+	// 落ちたときこそ直前の履歴が必要なので、クラッシュしても表示する
+	if (show_trace && !dump_trace(argv[optind], avr)) return 1;
+	if (show_probes) {
+		probes.print_summary();
+	}
+	if (folded_path && !probes.write_folded(folded_path)) {
+		perror(folded_path);
+		return 1;
+	}
+	if (state == cpu_Crashed) return 1;
+	if (check_self_test && load.entered(load_meter::SELF_TEST_FAULT)) {
+		fprintf(stderr, "self test reported a fault (build with TRACE_DEPTH and use -T for the codes)\n");
+		return 3;
+	}
+	if (load_budget >= 0 && !load.print_summary(load_budget)) return 2;
+	return 0;
+}
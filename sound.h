@@ -0,0 +1,217 @@
+#ifndef SOUND_H
+#define SOUND_H
+
+/*
+  効果音(SOUND != 0のとき)
+
+  音はタイマのCTCモードのコンペアマッチで出力ピンをトグルして出すので、鳴っている間CPUは何もしない。
+  ティックごとにするのは、音符の残り時間を1つ減らすことと、音符が終わったときに
+  フラッシュから次の音符を読んでタイマのTOPを書き換えることだけ。
+
+    SOUND_OC2B  Timer2、PD3(OC2B)から出力。プリスケーラ1/32(16MHz、20MHzでは1/128)
+    SOUND_OC1A  Timer1、PB1(OC1A)から出力。プリスケーラ1/8
+
+  音の高さはタイマのクロックで決まるので、鳴っている間はclock_profileで全速を保持する。
+  出力ピンとスピーカの間には100Ω程度の抵抗とコンデンサを入れること。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "config.h"
+#include "power_profile.h"
+#include "clock_profile.h"
+
+enum class sound_effect : uint8_t
+{
+	hit,    // 打ち返したとき
+	game_over,
+	high_score,    // ハイスコアを更新したとき
+};
+
+#if SOUND
+
+namespace sound_data
+{
+	// 音の高さ。note_frequencyの添字
+	enum note : uint8_t
+	{
+		REST, C5, D5, E5, F5, G5, A5, B5, C6, D6, E6, F6, G6, A6, B6, C7,
+		END = 0xFF,
+	};
+
+	// 周波数(Hz)
+	constexpr uint16_t note_frequency[] {0, 523, 587, 659, 698, 784, 880, 988, 1047, 1175, 1319, 1397, 1568, 1760, 1976, 2093};
+
+	// lengthは約2ms単位(FAST_TICKでなければ1ティック)。noteがENDで終わり
+	struct note_event
+	{
+		note pitch;
+		uint8_t length;
+	};
+
+	const note_event hit_sound[] PROGMEM {{C7, 12}, {END, 0}};
+	const note_event game_over_sound[] PROGMEM {{G5, 60}, {E5, 60}, {C5, 150}, {END, 0}};
+	const note_event high_score_sound[] PROGMEM {
+		{C6, 40}, {E6, 40}, {G6, 40}, {C7, 100}, {REST, 20}, {G6, 30}, {C7, 200}, {END, 0}
+	};
+
+	const note_event* const effects[] PROGMEM {hit_sound, game_over_sound, high_score_sound};
+}
+
+// Timer2のCTCモードでOC2B(PD3)をトグルする。TOPはOCR2A
+class tone_timer2
+{
+public:
+	static constexpr uint16_t PRESCALER = board_clock::TONE2_PRESCALER;
+	using top_type = uint8_t;
+
+	static void start() {
+		power_profile::instance().acquire(peripheral::timer2);
+		TCCR2A = _BV(WGM21);
+		OCR2B = 0;
+		TCCR2B = board_clock::TONE2_CS;
+	}
+
+	static void tone(top_type top) {
+		OCR2A = top;
+		TCNT2 = 0;    // 新しいTOPより先まで数えていると一周してしまうので
+		TCCR2A = _BV(WGM21) | _BV(COM2B0);
+	}
+
+	// 出力を切り離すとPORTの値(Low)になる
+	static void rest() {
+		TCCR2A = _BV(WGM21);
+	}
+
+	static void stop() {
+		TCCR2B = 0;
+		TCCR2A = 0;
+		power_profile::instance().release(peripheral::timer2);
+	}
+};
+
+// Timer1のCTCモードでOC1A(PB1)をトグルする。TOPはOCR1A
+class tone_timer1
+{
+public:
+	static constexpr uint16_t PRESCALER = 8;
+	using top_type = uint16_t;
+
+	static void start() {
+		power_profile::instance().acquire(peripheral::timer1);
+		TCCR1A = 0;
+		TCCR1B = _BV(WGM12) | _BV(CS11);
+	}
+
+	static void tone(top_type top) {
+		OCR1A = top;
+		TCNT1 = 0;
+		TCCR1A = _BV(COM1A0);
+	}
+
+	static void rest() {
+		TCCR1A = 0;
+	}
+
+	static void stop() {
+		TCCR1B = 0;
+		TCCR1A = 0;
+		power_profile::instance().release(peripheral::timer1);
+	}
+};
+
+template <class Output>
+class sound_engine
+{
+public:
+	// 鳴っている効果音は止めて、新しいほうを鳴らす
+	void play(sound_effect effect) {
+		if (!m_next) {
+			Output::start();
+			clock_profile::instance().hold_full();
+		}
+		m_next = static_cast<const sound_data::note_event*>(pgm_read_ptr(&sound_data::effects[static_cast<uint8_t>(effect)]));
+		m_remaining = 1;    // 次のティックで最初の音符を読む
+		m_unit_ticks = static_cast<uint8_t>(TICKS_PER_UNIT - 1);
+	}
+
+	// タイマ割り込みから毎ティック呼ぶ
+	void update() {
+		if (!m_next) return;
+		if (TICKS_PER_UNIT > 1) {
+			if (++m_unit_ticks < TICKS_PER_UNIT) return;
+			m_unit_ticks = 0;
+		}
+		if (--m_remaining != 0) return;
+		auto pitch = static_cast<sound_data::note>(pgm_read_byte(&m_next->pitch));
+		if (pitch == sound_data::END) {
+			m_next = nullptr;
+			Output::stop();
+			clock_profile::instance().release_full();
+			return;
+		}
+		m_remaining = pgm_read_byte(&m_next->length);
+		++m_next;
+		if (pitch == sound_data::REST) {
+			Output::rest();
+		} else {
+			Output::tone(read_top(&tops[pitch]));
+		}
+	}
+
+private:
+	using top_type = typename Output::top_type;
+
+	// 音符の長さの単位(約2ms)のティック数
+	static constexpr uint8_t TICKS_PER_UNIT = static_cast<uint8_t>(BASE_TICK_COUNTS / TICK_COUNTS);
+
+	// 周波数fを出すTOP。トグルなので1周期にコンペアマッチが2回
+	static constexpr top_type top_for(uint16_t f) {
+		return f == 0 ? 0 : static_cast<top_type>(F_CPU / (2UL * Output::PRESCALER * f) - 1);
+	}
+
+	static top_type read_top(const top_type* p) {
+		return static_cast<top_type>(sizeof(top_type) == 1 ? pgm_read_byte(p) : pgm_read_word(p));
+	}
+
+	static_assert(F_CPU / (2UL * Output::PRESCALER * sound_data::note_frequency[sound_data::C5]) - 1 <= static_cast<top_type>(~0u),
+		"the lowest note does not fit in the timer.");
+
+	static const top_type tops[sizeof(sound_data::note_frequency) / sizeof(sound_data::note_frequency[0])];
+
+	const sound_data::note_event* m_next = nullptr;    // 次に読む音符。nullptrなら鳴っていない
+	uint8_t m_remaining = 0;
+	uint8_t m_unit_ticks = 0;
+};
+
+template <class Output>
+const typename sound_engine<Output>::top_type sound_engine<Output>::tops[] PROGMEM {
+	top_for(sound_data::note_frequency[0]), top_for(sound_data::note_frequency[1]), top_for(sound_data::note_frequency[2]),
+	top_for(sound_data::note_frequency[3]), top_for(sound_data::note_frequency[4]), top_for(sound_data::note_frequency[5]),
+	top_for(sound_data::note_frequency[6]), top_for(sound_data::note_frequency[7]), top_for(sound_data::note_frequency[8]),
+	top_for(sound_data::note_frequency[9]), top_for(sound_data::note_frequency[10]), top_for(sound_data::note_frequency[11]),
+	top_for(sound_data::note_frequency[12]), top_for(sound_data::note_frequency[13]), top_for(sound_data::note_frequency[14]),
+	top_for(sound_data::note_frequency[15]),
+};
+
+#if SOUND == SOUND_OC2B
+using sound_type = sound_engine<tone_timer2>;
+#else
+using sound_type = sound_engine<tone_timer1>;
+#endif
+
+#else
+
+class sound_type
+{
+public:
+	void play(sound_effect) {}
+	void update() {}
+};
+
+#endif
+
+#endif
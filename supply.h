@@ -0,0 +1,155 @@
+#ifndef SUPPLY_H
+#define SUPPLY_H
+
+/*
+  電源電圧の監視(SUPPLY_MONITOR = 1のとき)
+
+  AVCCを基準にして内部の1.1Vバンドギャップを測ると、ADC = 1.1V * 1024 / VCCになるので、
+  外付けの部品なしでVCCが分かる。バンドギャップの電圧は個体差(1.0～1.2V)があるので、
+  正確に合わせたいときはSUPPLY_BANDGAP_MVをテスタで測ったVCCに合わせて調整する。
+
+  約0.5秒ごとに1回測る。
+    ・AMBIENT_LIGHTがあるとき: 光センサの変換(brightness.hが約32msごとに始める)が終わったところで
+      チャンネルをバンドギャップに切り替え、次の2回を変換してチャンネルを戻す(光センサの値は2回分抜ける)
+    ・AMBIENT_LIGHTがないとき: 測るときだけADCを有効にし、Timer0のコンペアマッチAを自動トリガにして
+      続く2ティックの頭で2回変換したら止める(0.5秒に2回なので、割り込みはほとんど増えない)
+  チャンネルを切り替えた直後の1回はバンドギャップが安定していないことがあるので捨てる。
+
+  SUPPLY_LOW_MVを下回ったら電圧が低い状態にし、100mV上がるまで戻さない。
+  電圧が低い間は、EEPROMへの書き込みを後回しにし(persistent.h)、表示を暗くする(brightness.h)。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+
+#include "config.h"
+#include "power_profile.h"
+#include "clock_profile.h"
+
+#if SUPPLY_MONITOR
+
+class supply_monitor
+{
+public:
+	static constexpr uint16_t LOW_MV = SUPPLY_LOW_MV;
+	static constexpr uint16_t HYSTERESIS_MV = 100;
+
+	void init() {
+		m_countdown = 1;    // 最初のティックで測り始める
+	}
+
+	// タイマ割り込みから毎ティック呼ぶ
+	void update() {
+		if (m_phase != phase::idle || --m_countdown != 0) return;
+		m_countdown = PERIOD_TICKS;
+#if AMBIENT_LIGHT
+		// 変換中にチャンネルを変えると、どちらの値か分からなくなるので、変換が終わるのを待つ
+		m_phase = phase::requested;
+#else
+		power_profile::instance().acquire(peripheral::adc);
+		ADMUX = BANDGAP_MUX;
+		ADCSRB = _BV(ADTS1) | _BV(ADTS0);    // Timer0のコンペアマッチAで変換開始
+		ADCSRA = static_cast<uint8_t>(_BV(ADEN) | _BV(ADATE) | _BV(ADIE) | clock_profile::instance().adc_prescaler());
+		m_phase = phase::settling;
+#endif
+	}
+
+	// ADC_vectから呼ぶ。バンドギャップの変換だったときはtrue(ほかの用途には使わない)
+	bool on_conversion(uint16_t sample) {
+		switch (m_phase) {
+		case phase::idle:
+			return false;
+		case phase::requested:
+			m_saved_mux = ADMUX;
+			ADMUX = BANDGAP_MUX;
+			m_phase = phase::settling;
+			return false;
+		case phase::settling:
+			m_phase = phase::measuring;
+			return true;
+		case phase::measuring:
+			break;
+		}
+#if AMBIENT_LIGHT
+		ADMUX = m_saved_mux;
+#else
+		ADCSRA = 0;
+		power_profile::instance().release(peripheral::adc);
+#endif
+		m_phase = phase::idle;
+		record(sample);
+		return true;
+	}
+
+	// 平均した電源電圧(mV)。まだ測っていなければ0
+	uint16_t millivolts() const {
+		return m_millivolts;
+	}
+
+	bool low() const {
+		return m_low;
+	}
+
+	// EEPROMに書いてもよいか
+	bool eeprom_safe() const {
+		return !m_low;
+	}
+
+private:
+	// REFS0(AVCC基準)とMUX3..1(1.1Vバンドギャップ)
+	static constexpr uint8_t BANDGAP_MUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
+	// 約0.5秒(FAST_TICKでないときの256ティック)
+	static constexpr uint16_t PERIOD_TICKS = static_cast<uint16_t>(256UL * BASE_TICK_COUNTS / TICK_COUNTS);
+
+	enum class phase : uint8_t
+	{
+		idle,
+		requested,    // 光センサの変換が終わったら切り替える
+		settling,    // 切り替えた直後。値は捨てる
+		measuring,
+	};
+
+	void record(uint16_t sample) {
+		if (sample == 0) return;
+		uint16_t mv = static_cast<uint16_t>(static_cast<uint32_t>(SUPPLY_BANDGAP_MV) * 1024 / sample);
+		// 指数移動平均(1/4)。最初の1回はそのまま
+		m_millivolts = m_millivolts == 0 ? mv : static_cast<uint16_t>((3UL * m_millivolts + mv) / 4);
+		if (m_millivolts < LOW_MV) {
+			m_low = true;
+		} else if (m_millivolts >= LOW_MV + HYSTERESIS_MV) {
+			m_low = false;
+		}
+	}
+
+	uint16_t m_countdown = 1;
+	uint16_t m_millivolts = 0;
+	phase m_phase = phase::idle;
+	uint8_t m_saved_mux = 0;
+	bool m_low = false;
+};
+
+#else
+
+class supply_monitor
+{
+public:
+	void init() {}
+	void update() {}
+	bool on_conversion(uint16_t) {
+		return false;
+	}
+	uint16_t millivolts() const {
+		return 0;
+	}
+	bool low() const {
+		return false;
+	}
+	bool eeprom_safe() const {
+		return true;
+	}
+};
+
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+/*
+  ゲームのイベントをUARTで送るテレメトリ
+
+  レコードの形式はtelemetry_protocol.hを参照。積むのはリングバッファへのコピーだけで、
+  送信はUDRE割り込みで行うので、playingのタイミングには影響しない。
+  TELEMETRY = 0のときは何もしないクラスになる
+ */
+
+#include <stdint.h>
+
+#include "config.h"
+#include "telemetry_protocol.h"
+
+#if USE_UART
+
+#include "uart.h"
+
+// UARTにレコードを書き出す。テレメトリとリモートコマンドの応答で共用
+class record_writer
+{
+public:
+	record_writer(uart_port& port) : m_port(port) {}
+
+	// 送信バッファに入りきらなければ捨ててfalseを返す
+	template <telemetry_protocol::record_type Type, class... Payload>
+	bool put(Payload... payload) {
+		static_assert(sizeof...(Payload) == telemetry_protocol::payload_size(Type), "payload size mismatch");
+		const uint8_t record[] {telemetry_protocol::SYNC, sizeof...(Payload) + 1, static_cast<uint8_t>(Type), payload...};
+		return m_port.write(record, sizeof(record));
+	}
+
+private:
+	uart_port& m_port;
+};
+
+#endif
+
+#if TELEMETRY
+
+class telemetry_stream
+{
+public:
+	telemetry_stream(record_writer& writer) : m_writer(writer) {}
+
+	void game_start() {
+		m_writer.put<telemetry_protocol::record_type::game_start>();
+	}
+
+	void hit(uint8_t score, uint8_t offset, uint8_t speed) {
+		m_writer.put<telemetry_protocol::record_type::hit>(score, offset, speed);
+	}
+
+	void game_over(uint8_t score, uint8_t speed) {
+		m_writer.put<telemetry_protocol::record_type::game_over>(score, speed);
+	}
+
+	void high_score(uint8_t score) {
+		m_writer.put<telemetry_protocol::record_type::high_score>(score);
+	}
+
+private:
+	record_writer& m_writer;
+};
+
+#else
+
+class telemetry_stream
+{
+public:
+	void game_start() {}
+	void hit(uint8_t, uint8_t, uint8_t) {}
+	void game_over(uint8_t, uint8_t) {}
+	void high_score(uint8_t) {}
+};
+
+#endif
+
+#endif
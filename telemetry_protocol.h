@@ -0,0 +1,65 @@
+#ifndef TELEMETRY_PROTOCOL_H
+#define TELEMETRY_PROTOCOL_H
+
+/*
+  テレメトリのレコード形式。ファームウェアとホスト側のツールで共有する
+
+  [SYNC][len][type][payload...]
+    SYNC    0xA5。受信側が途中から読み始めたときの同期用
+    len     typeとpayloadを合わせたバイト数
+    type    record_type
+    payload typeごとに固定長
+ */
+
+#include <stdint.h>
+
+namespace telemetry_protocol
+{
+	constexpr uint8_t SYNC = 0xA5;
+	constexpr uint8_t HEADER_SIZE = 2;    // SYNCとlen
+
+	enum class record_type : uint8_t
+	{
+		game_start = 0x01,    // payloadなし
+		hit = 0x02,    // score, offset, speed
+		game_over = 0x03,    // score, speed
+		high_score = 0x04,    // score
+
+		// リモートコマンド(command_protocol.h)への応答
+		ack = 0x10,    // command, result
+		status = 0x11,    // high_score, difficulty, state, games(2), hits(2)
+		trace = 0x12,    // time(2), event, arg。trace_record(trace.h)と同じ並び
+	};
+
+	// ackのresult
+	enum class result : uint8_t
+	{
+		ok = 0,
+		invalid = 1,    // 知らないコマンド、範囲外の引数
+		busy = 2,    // プレイ中は受け付けない
+	};
+
+	// payloadのバイト数。未知のtypeは0xFF
+	constexpr uint8_t payload_size(record_type type) {
+		return type == record_type::game_start ? 0
+			: type == record_type::hit ? 3
+			: type == record_type::game_over ? 2
+			: type == record_type::high_score ? 1
+			: type == record_type::ack ? 2
+			: type == record_type::status ? 7
+			: type == record_type::trace ? 4
+			: 0xFF;
+	}
+
+	/*
+	  各フィールドの意味
+	    score   その時点のスコア(hitでは加算後)
+	    offset  バーが判定範囲に入ってからボタンが押されるまでのティック数
+	    speed   バーが1つ進むのにかかるティック数(小さいほど速い)
+	    ティック数は約2ms(Timer0の256カウント)単位。FAST_TICKでも同じ単位に換算して送る
+	    state   game_managerの状態(game_state)
+	    games, hits  起動してからのゲーム数と成功数。リトルエンディアン
+	 */
+}
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+/*
+  ハッシュ化したタイマホイール
+
+  タイマは期限のティック数をSlotsで割った余りのスロットのリストにつなぐ。
+  ティックごとに見るのは今のスロットのリストだけで、そこにつながっているタイマの
+  残り周回数を減らすか、0なら期限切れにする。登録と取り消しはリストへの付け外しだけ。
+  タイマはCapacity個までで、idで区別する(idはOwnerが決める)。
+
+  期限が来たタイマのコールバックはOwnerのメンバ関数。コールバックの中でタイマを
+  登録、取り消ししてもよい(同じティックで期限切れになった別のタイマを取り消せば、
+  そのコールバックは呼ばれない)。
+  periodを指定したタイマは、コールバックを呼ぶ前にperiodティック後に登録し直す。
+
+  AVRに依存するものは使っていないので、ホストでもそのまま動く(bench/を参照)。
+ */
+
+#include <stdint.h>
+
+template <class Owner, uint8_t Slots, uint8_t Capacity>
+class timer_wheel
+{
+	static_assert(Slots >= 2 && (Slots & (Slots - 1)) == 0, "slots must be a power of 2.");
+	static_assert(Capacity >= 1 && Capacity <= 8, "capacity must be 1 to 8.");
+public:
+	using callback = void (Owner::*)();
+
+	timer_wheel() {
+		for (auto& h : m_head) {
+			h = NONE;
+		}
+	}
+
+	// delayティック後(最低1、最大Slots * 65536)にcbを呼ぶ。同じidのタイマがあれば置き換える
+	void schedule(uint8_t id, uint32_t delay, callback cb, uint16_t period = 0) {
+		cancel(id);
+		entry& e = m_entries[id];
+		e.cb = cb;
+		e.period = period;
+		insert(id, delay);
+	}
+
+	void cancel(uint8_t id) {
+		m_pending = static_cast<uint8_t>(m_pending & ~(1u << id));
+		entry& e = m_entries[id];
+		if (e.slot == NONE) return;
+		if (e.prev == NONE) {
+			m_head[e.slot] = e.next;
+		} else {
+			m_entries[e.prev].next = e.next;
+		}
+		if (e.next != NONE) {
+			m_entries[e.next].prev = e.prev;
+		}
+		e.slot = NONE;
+	}
+
+	void cancel_all() {
+		for (uint8_t id = 0; id < Capacity; ++id) {
+			cancel(id);
+		}
+	}
+
+	bool active(uint8_t id) const {
+		return m_entries[id].slot != NONE;
+	}
+
+	// 毎ティック呼ぶ
+	void advance(Owner& owner) {
+		m_cursor = static_cast<uint8_t>((m_cursor + 1) & (Slots - 1));
+		// 先に期限切れのタイマをリストから外し、それからコールバックを呼ぶ
+		uint8_t id = m_head[m_cursor];
+		while (id != NONE) {
+			entry& e = m_entries[id];
+			uint8_t next = e.next;
+			if (e.rounds == 0) {
+				cancel(id);
+				m_pending = static_cast<uint8_t>(m_pending | (1u << id));
+			} else {
+				--e.rounds;
+			}
+			id = next;
+		}
+		for (id = 0; m_pending != 0; ++id) {
+			uint8_t bit = static_cast<uint8_t>(1u << id);
+			if ((m_pending & bit) == 0) continue;
+			m_pending = static_cast<uint8_t>(m_pending & ~bit);
+			entry& e = m_entries[id];
+			callback cb = e.cb;
+			if (e.period != 0) {
+				insert(id, e.period);
+			}
+			(owner.*cb)();
+		}
+	}
+
+private:
+	static constexpr uint8_t NONE = 0xFF;
+
+	struct entry
+	{
+		callback cb;
+		uint16_t rounds;    // あと何周したら期限か
+		uint16_t period;
+		uint8_t slot = NONE;    // つながっているスロット。NONEなら止まっている
+		uint8_t prev;
+		uint8_t next;
+	};
+
+	void insert(uint8_t id, uint32_t delay) {
+		if (delay == 0) delay = 1;
+		entry& e = m_entries[id];
+		uint8_t slot = static_cast<uint8_t>((m_cursor + delay) & (Slots - 1));
+		e.rounds = static_cast<uint16_t>((delay - 1) / Slots);
+		e.slot = slot;
+		e.prev = NONE;
+		e.next = m_head[slot];
+		if (e.next != NONE) {
+			m_entries[e.next].prev = id;
+		}
+		m_head[slot] = id;
+	}
+
+	entry m_entries[Capacity];
+	uint8_t m_head[Slots];
+	uint8_t m_cursor = 0;
+	uint8_t m_pending = 0;    // 期限切れでコールバック待ちのタイマ(ビットがid)
+};
+
+#endif
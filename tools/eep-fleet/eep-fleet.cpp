@@ -0,0 +1,603 @@
+/*
+  eep-fleet: 筐体から吸い出したEEPROMのダンプ(.eep)をまとめて集計するツール
+
+  使い方
+    eep-fleet [オプション] PATH...
+
+    PATH            .eepファイル、またはそれを含むディレクトリ(下の階層もたどる)
+    -e ELF          ダンプを取ったファームウェアのELF。EEPROMの変数の位置をシンボル表から取る
+                    (make EEP_FLEET_ELF=1でビルドしたときだけ。libelfが要る)
+    -l A,B,C,D      EEPROMの変数の位置(ハイスコア、難易度、ゲーム数、打ち返した回数)を直接指定する。
+                    avr-nm -C avr-hokey.elfで見える_eepromのアドレスから0x810000を引いた値。
+                    使わない変数は-1
+    -j N            スレッド数。既定はコア数
+    -t N            ハイスコアの上位N台を表示する。既定は10
+    -c FILE         1台ごとの値をCSVでFILEに書き出す(PATHで見つけた順)
+    -g DIR          ベンチマーク用に、合成したダンプをDIRに作る
+    -n COUNT        -gで作るダンプの数。既定は100000
+
+  .eepはMakefileの%.eepと同じIntel HEX(avrdudeの-U eeprom:r:FILE:iで読み出したものも同じ)。
+  各スレッドはファイルの番号を1つずつ取り、mmapしたファイルの上で直接レコードを読む(コピーしない)。
+  必要なアドレスが全部そろったら、その先は読まない。集計値はスレッドごとに持ち、最後に足し合わせる。
+
+  EEPROMの変数(avr-hokey.cpp)
+    high_score_manager::high_score_eeprom   uint8_t   ハイスコア
+    difficulty_manager::difficulty_eeprom   uint8_t   難易度(0～2)
+    statistics_manager::games_eeprom        uint16_t  通算のゲーム数(POWER_FAILのときだけ)
+    statistics_manager::hits_eeprom         uint16_t  通算の打ち返した回数(同上)
+  位置はリンカが決めるので-eか-lで渡すのが確実。省略したときは定義順に詰めた位置(0, 1, 2, 4)とみなす。
+  消去したままの値(0xFF, 0xFFFF)とダンプにないアドレスは、書き込んだことがないものとして扱う。
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if EEP_FLEET_ELF
+#include <gelf.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	constexpr uint32_t EEPROM_OFFSET = 0x810000;    // ELFでのEEPROMのアドレス
+	constexpr int SCORE_BUCKETS = 10;    // ハイスコア10点ごと
+	constexpr int DIFFICULTIES = 3;
+
+	// 読み出す変数。fieldの順に並べる
+	enum field : uint8_t
+	{
+		HIGH_SCORE,
+		DIFFICULTY,
+		GAMES,
+		HITS,
+		FIELD_COUNT,
+	};
+
+	struct field_info
+	{
+		const char* symbol;
+		uint8_t size;
+	};
+
+	constexpr field_info FIELDS[FIELD_COUNT] {
+		{"_ZN18high_score_manager17high_score_eepromE", 1},
+		{"_ZN18difficulty_manager17difficulty_eepromE", 1},
+		{"_ZN18statistics_manager12games_eepromE", 2},
+		{"_ZN18statistics_manager11hits_eepromE", 2},
+	};
+
+	// 変数のEEPROMでのアドレス。なければ-1
+	struct layout
+	{
+		int32_t address[FIELD_COUNT] {0, 1, 2, 4};
+	};
+
+	// 1台分の値
+	struct cabinet
+	{
+		enum status_type : uint8_t
+		{
+			ok,
+			unreadable,    // 開けない、mmapできない
+			broken,    // Intel HEXとして読めない(チェックサムの誤りなど)
+		};
+
+		uint16_t value[FIELD_COUNT];    // 読めなかったバイトは0xFF
+		status_type status;
+	};
+
+	// 集計値。スレッドごとに持ち、最後に足し合わせる
+	struct stats
+	{
+		uint64_t files = 0;
+		uint64_t bytes = 0;
+		uint64_t unreadable = 0;
+		uint64_t broken = 0;
+		uint64_t blank = 0;    // ハイスコアを書き込んだことがない
+		uint64_t scored = 0;
+		uint64_t score_sum = 0;
+		uint8_t max_score = 0;
+		uint64_t score_buckets[SCORE_BUCKETS] = {};
+		uint64_t difficulty[DIFFICULTIES + 1] = {};    // 最後は範囲外(書き込んだことがない)
+		uint64_t counted = 0;    // ゲーム数を持っている台
+		uint64_t games = 0;
+		uint64_t hits = 0;
+
+		void on_cabinet(const cabinet& c) {
+			++files;
+			if (c.status == cabinet::unreadable) {
+				++unreadable;
+				return;
+			}
+			if (c.status == cabinet::broken) {
+				++broken;
+				return;
+			}
+			uint16_t score = c.value[HIGH_SCORE];
+			if (score == 0xFF) {
+				++blank;
+			} else {
+				++scored;
+				score_sum += score;
+				if (score > max_score) max_score = static_cast<uint8_t>(score);
+				++score_buckets[score / 10 < SCORE_BUCKETS ? score / 10 : SCORE_BUCKETS - 1];
+			}
+			++difficulty[c.value[DIFFICULTY] < DIFFICULTIES ? c.value[DIFFICULTY] : DIFFICULTIES];
+			if (c.value[GAMES] != 0xFFFF) {
+				++counted;
+				games += c.value[GAMES];
+				hits += c.value[HITS] == 0xFFFF ? 0 : c.value[HITS];
+			}
+		}
+
+		void merge(const stats& s) {
+			files += s.files;
+			bytes += s.bytes;
+			unreadable += s.unreadable;
+			broken += s.broken;
+			blank += s.blank;
+			scored += s.scored;
+			score_sum += s.score_sum;
+			if (s.max_score > max_score) max_score = s.max_score;
+			for (int i = 0; i < SCORE_BUCKETS; ++i) score_buckets[i] += s.score_buckets[i];
+			for (int i = 0; i <= DIFFICULTIES; ++i) difficulty[i] += s.difficulty[i];
+			counted += s.counted;
+			games += s.games;
+			hits += s.hits;
+		}
+	};
+
+	// -lの「A,B,C,D」。10進か0x付きの16進
+	bool parse_layout(const char* text, layout& l)
+	{
+		for (int f = 0; f < FIELD_COUNT; ++f) {
+			char* end;
+			long value = strtol(text, &end, 0);
+			if (end == text || value < -1 || value > 0xFFFF) return false;
+			l.address[f] = static_cast<int32_t>(value);
+			if (f == FIELD_COUNT - 1) return *end == '\0';
+			if (*end != ',') return false;
+			text = end + 1;
+		}
+		return false;
+	}
+
+#if EEP_FLEET_ELF
+	// ELFのシンボル表からEEPROMの変数の位置を取る
+	bool load_layout(const char* path, layout& l)
+	{
+		if (elf_version(EV_CURRENT) == EV_NONE) return false;
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) return false;
+		Elf* elf = elf_begin(fd, ELF_C_READ, nullptr);
+		bool found_symtab = false;
+		for (int i = 0; i < FIELD_COUNT; ++i) l.address[i] = -1;
+		Elf_Scn* scn = nullptr;
+		while (elf && (scn = elf_nextscn(elf, scn)) != nullptr) {
+			GElf_Shdr shdr;
+			if (!gelf_getshdr(scn, &shdr) || shdr.sh_type != SHT_SYMTAB) continue;
+			found_symtab = true;
+			Elf_Data* data = elf_getdata(scn, nullptr);
+			size_t count = shdr.sh_entsize ? shdr.sh_size / shdr.sh_entsize : 0;
+			for (size_t i = 0; data && i < count; ++i) {
+				GElf_Sym sym;
+				if (!gelf_getsym(data, static_cast<int>(i), &sym) || sym.st_value < EEPROM_OFFSET) continue;
+				const char* name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+				for (int f = 0; name && f < FIELD_COUNT; ++f) {
+					if (strcmp(name, FIELDS[f].symbol) == 0) {
+						l.address[f] = static_cast<int32_t>(sym.st_value - EEPROM_OFFSET);
+					}
+				}
+			}
+		}
+		if (elf) elf_end(elf);
+		close(fd);
+		return found_symtab && l.address[HIGH_SCORE] >= 0;
+	}
+#endif
+
+	int hex_digit(uint8_t c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		return -1;
+	}
+
+	// 2桁の16進数。読めなければ-1
+	int hex_byte(const uint8_t* p)
+	{
+		int high = hex_digit(p[0]);
+		int low = hex_digit(p[1]);
+		return high < 0 || low < 0 ? -1 : high << 4 | low;
+	}
+
+	// Intel HEXのレコードを順に読み、layoutのアドレスのバイトを取り出す
+	class hex_decoder
+	{
+	public:
+		explicit hex_decoder(const layout& l) {
+			for (int f = 0; f < FIELD_COUNT; ++f) {
+				for (int i = 0; i < FIELDS[f].size; ++i) {
+					if (l.address[f] < 0) continue;
+					m_wanted[m_count].address = static_cast<uint32_t>(l.address[f] + i);
+					m_wanted[m_count].field = static_cast<uint8_t>(f);
+					m_wanted[m_count].shift = static_cast<uint8_t>(i * 8);
+					++m_count;
+				}
+			}
+		}
+
+		cabinet::status_type decode(const uint8_t* p, const uint8_t* end, cabinet& c) const {
+			uint8_t bytes[MAX_WANTED];
+			memset(bytes, 0xFF, sizeof(bytes));
+			int remaining = m_count;
+			uint32_t base = 0;
+			while (p < end && remaining > 0) {
+				if (*p != ':') {
+					++p;    // 改行など
+					continue;
+				}
+				if (end - p < 11) return cabinet::broken;
+				int length = hex_byte(p + 1);
+				int address_high = hex_byte(p + 3);
+				int address_low = hex_byte(p + 5);
+				int type = hex_byte(p + 7);
+				if (length < 0 || address_high < 0 || address_low < 0 || type < 0 || end - p < 11 + length * 2) return cabinet::broken;
+				uint8_t sum = static_cast<uint8_t>(length + address_high + address_low + type);
+				const uint8_t* data = p + 9;
+				for (int i = 0; i <= length; ++i) {
+					int b = hex_byte(data + i * 2);
+					if (b < 0) return cabinet::broken;
+					sum = static_cast<uint8_t>(sum + b);
+				}
+				if (sum != 0) return cabinet::broken;
+				uint32_t address = base + static_cast<uint32_t>(address_high << 8 | address_low);
+				switch (type) {
+				case 0x00:    // データ
+					for (int w = 0; w < m_count; ++w) {
+						uint32_t offset = m_wanted[w].address - address;
+						if (m_wanted[w].address >= address && offset < static_cast<uint32_t>(length)) {
+							bytes[w] = static_cast<uint8_t>(hex_byte(data + offset * 2));
+							--remaining;
+						}
+					}
+					break;
+				case 0x01:    // 終わり
+					remaining = 0;
+					break;
+				case 0x02:    // 拡張セグメントアドレス
+					if (length == 2) base = static_cast<uint32_t>(hex_byte(data) << 8 | hex_byte(data + 2)) << 4;
+					break;
+				case 0x04:    // 拡張リニアアドレス
+					if (length == 2) base = static_cast<uint32_t>(hex_byte(data) << 8 | hex_byte(data + 2)) << 16;
+					break;
+				default:
+					break;
+				}
+				p = data + length * 2 + 2;
+			}
+			for (int f = 0; f < FIELD_COUNT; ++f) {
+				c.value[f] = static_cast<uint16_t>(FIELDS[f].size == 2 ? 0xFFFF : 0xFF);
+			}
+			for (int w = 0; w < m_count; ++w) {
+				uint16_t& v = c.value[m_wanted[w].field];
+				v = static_cast<uint16_t>((v & ~(0xFF << m_wanted[w].shift)) | bytes[w] << m_wanted[w].shift);
+			}
+			return cabinet::ok;
+		}
+
+	private:
+		static constexpr int MAX_WANTED = 8;
+
+		struct wanted
+		{
+			uint32_t address;
+			uint8_t field;
+			uint8_t shift;
+		};
+
+		wanted m_wanted[MAX_WANTED];
+		int m_count = 0;
+	};
+
+	// 1ファイル。mmapできないもの(空のファイルなど)は読めなかったことにする
+	cabinet read_dump(const std::string& path, const hex_decoder& decoder, uint64_t& bytes)
+	{
+		cabinet c{};
+		c.status = cabinet::unreadable;
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return c;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			size_t size = static_cast<size_t>(st.st_size);
+			void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED) {
+				const uint8_t* p = static_cast<const uint8_t*>(map);
+				c.status = decoder.decode(p, p + size, c);
+				bytes += size;
+				munmap(map, size);
+			}
+		}
+		close(fd);
+		return c;
+	}
+
+	bool has_eep_suffix(const char* name)
+	{
+		size_t length = strlen(name);
+		return length > 4 && strcmp(name + length - 4, ".eep") == 0;
+	}
+
+	// ディレクトリは下の階層までたどって.eepを集める
+	void collect(const std::string& path, std::vector<std::string>& files)
+	{
+		DIR* dir = opendir(path.c_str());
+		if (!dir) {
+			files.push_back(path);
+			return;
+		}
+		std::vector<std::string> subdirs;
+		size_t first = files.size();
+		while (dirent* e = readdir(dir)) {
+			if (e->d_name[0] == '.') continue;
+			std::string child = path + "/" + e->d_name;
+			bool is_dir = e->d_type == DT_DIR;
+			if (e->d_type == DT_UNKNOWN) {
+				struct stat st;
+				is_dir = stat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+			}
+			if (is_dir) {
+				subdirs.push_back(child);
+			} else if (has_eep_suffix(e->d_name)) {
+				files.push_back(child);
+			}
+		}
+		closedir(dir);
+		// 毎回同じ順に並べる(CSVの行の順)
+		std::sort(files.begin() + static_cast<ptrdiff_t>(first), files.end());
+		std::sort(subdirs.begin(), subdirs.end());
+		for (const auto& d : subdirs) collect(d, files);
+	}
+
+	void print_report(const stats& fleet, const std::vector<std::string>& files, const std::vector<cabinet>& cabinets, int top, double elapsed_sec, unsigned threads)
+	{
+		printf("fleet: files=%llu (%.1f MB, %.2f s, %.0f files/s, %u threads) unreadable=%llu broken=%llu\n",
+			static_cast<unsigned long long>(fleet.files),
+			static_cast<double>(fleet.bytes) / 1e6,
+			elapsed_sec,
+			elapsed_sec > 0 ? static_cast<double>(fleet.files) / elapsed_sec : 0.0,
+			threads,
+			static_cast<unsigned long long>(fleet.unreadable),
+			static_cast<unsigned long long>(fleet.broken));
+		printf("high score: cabinets=%llu blank=%llu avg=%.2f max=%u\n",
+			static_cast<unsigned long long>(fleet.scored),
+			static_cast<unsigned long long>(fleet.blank),
+			fleet.scored ? static_cast<double>(fleet.score_sum) / static_cast<double>(fleet.scored) : 0.0,
+			fleet.max_score);
+		printf("high score:");
+		for (int i = 0; i < SCORE_BUCKETS; ++i) {
+			printf(" %d-:%llu", i * 10, static_cast<unsigned long long>(fleet.score_buckets[i]));
+		}
+		printf("\ndifficulty: easy=%llu normal=%llu hard=%llu blank=%llu\n",
+			static_cast<unsigned long long>(fleet.difficulty[0]),
+			static_cast<unsigned long long>(fleet.difficulty[1]),
+			static_cast<unsigned long long>(fleet.difficulty[2]),
+			static_cast<unsigned long long>(fleet.difficulty[DIFFICULTIES]));
+		if (fleet.counted > 0) {
+			printf("lifetime: cabinets=%llu games=%llu hits=%llu hits/game=%.2f\n",
+				static_cast<unsigned long long>(fleet.counted),
+				static_cast<unsigned long long>(fleet.games),
+				static_cast<unsigned long long>(fleet.hits),
+				fleet.games ? static_cast<double>(fleet.hits) / static_cast<double>(fleet.games) : 0.0);
+		}
+		// 上位は番号だけ部分ソートする
+		std::vector<uint32_t> order;
+		order.reserve(cabinets.size());
+		for (uint32_t i = 0; i < cabinets.size(); ++i) {
+			if (cabinets[i].status == cabinet::ok && cabinets[i].value[HIGH_SCORE] != 0xFF) order.push_back(i);
+		}
+		size_t count = std::min(order.size(), static_cast<size_t>(top));
+		std::partial_sort(order.begin(), order.begin() + static_cast<ptrdiff_t>(count), order.end(), [&](uint32_t a, uint32_t b) {
+			uint16_t score_a = cabinets[a].value[HIGH_SCORE];
+			uint16_t score_b = cabinets[b].value[HIGH_SCORE];
+			return score_a != score_b ? score_a > score_b : a < b;
+		});
+		if (count > 0) printf("top %zu:\n", count);
+		for (size_t i = 0; i < count; ++i) {
+			printf("  %3u  %s\n", cabinets[order[i]].value[HIGH_SCORE], files[order[i]].c_str());
+		}
+	}
+
+	bool write_csv(const char* path, const std::vector<std::string>& files, const std::vector<cabinet>& cabinets)
+	{
+		static const char* const status_names[] {"ok", "unreadable", "broken"};
+		FILE* out = fopen(path, "w");
+		if (!out) return false;
+		fprintf(out, "file,status,high_score,difficulty,games,hits\n");
+		for (size_t i = 0; i < cabinets.size(); ++i) {
+			const cabinet& c = cabinets[i];
+			fprintf(out, "%s,%s", files[i].c_str(), status_names[c.status]);
+			if (c.status == cabinet::ok) {
+				// 書き込んだことがない値は空欄にする
+				for (int f = 0; f < FIELD_COUNT; ++f) {
+					uint16_t blank = static_cast<uint16_t>(FIELDS[f].size == 2 ? 0xFFFF : 0xFF);
+					if (c.value[f] == blank) {
+						fprintf(out, ",");
+					} else {
+						fprintf(out, ",%u", c.value[f]);
+					}
+				}
+			} else {
+				fprintf(out, ",,,,");
+			}
+			fprintf(out, "\n");
+		}
+		return fclose(out) == 0;
+	}
+
+	// ベンチマーク用のダンプ。512バイトを16バイトずつのレコードにする(avrdudeの出力と同じ形)
+	bool generate(const char* dir, unsigned count, const layout& l)
+	{
+		if (mkdir(dir, 0755) < 0 && errno != EEXIST) return false;
+		unsigned seed = 1;
+		for (unsigned n = 0; n < count; ++n) {
+			uint8_t eeprom[512];
+			memset(eeprom, 0xFF, sizeof(eeprom));
+			seed = seed * 1103515245 + 12345;
+			if ((seed >> 16) % 50 != 0) {    // 2%はハイスコアを書き込んでいない
+				eeprom[l.address[HIGH_SCORE]] = static_cast<uint8_t>((seed >> 8) % 60 + (seed >> 20) % 40);
+			}
+			if (l.address[DIFFICULTY] >= 0) eeprom[l.address[DIFFICULTY]] = static_cast<uint8_t>((seed >> 12) % 4 == 0 ? 2 : 1);
+			if (l.address[GAMES] >= 0 && l.address[HITS] >= 0) {
+				uint16_t games = static_cast<uint16_t>((seed >> 4) % 5000);
+				uint16_t hits = static_cast<uint16_t>(games * ((seed >> 10) % 20));
+				eeprom[l.address[GAMES]] = static_cast<uint8_t>(games);
+				eeprom[l.address[GAMES] + 1] = static_cast<uint8_t>(games >> 8);
+				eeprom[l.address[HITS]] = static_cast<uint8_t>(hits);
+				eeprom[l.address[HITS] + 1] = static_cast<uint8_t>(hits >> 8);
+			}
+			char path[4096];
+			snprintf(path, sizeof(path), "%s/unit%06u.eep", dir, n);
+			FILE* out = fopen(path, "w");
+			if (!out) return false;
+			for (unsigned address = 0; address < sizeof(eeprom); address += 16) {
+				uint8_t sum = static_cast<uint8_t>(16 + (address >> 8) + address);
+				fprintf(out, ":10%04X00", address);
+				for (unsigned i = 0; i < 16; ++i) {
+					fprintf(out, "%02X", eeprom[address + i]);
+					sum = static_cast<uint8_t>(sum + eeprom[address + i]);
+				}
+				fprintf(out, "%02X\r\n", static_cast<uint8_t>(-sum));
+			}
+			fprintf(out, ":00000001FF\r\n");
+			if (fclose(out) != 0) return false;
+		}
+		return true;
+	}
+
+	void usage()
+	{
+		fprintf(stderr, "usage: eep-fleet [-e firmware.elf | -l A,B,C,D] [-j threads] [-t top] [-c file.csv] PATH...\n"
+			"       eep-fleet [-e firmware.elf | -l A,B,C,D] -g DIR [-n count]\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	const char* elf_path = nullptr;
+	const char* layout_text = nullptr;
+	const char* csv_path = nullptr;
+	const char* generate_dir = nullptr;
+	unsigned generate_count = 100000;
+	int top = 10;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "e:l:j:t:c:g:n:")) != -1) {
+		switch (opt) {
+		case 'e':
+			elf_path = optarg;
+			break;
+		case 'l':
+			layout_text = optarg;
+			break;
+		case 'j':
+			threads = static_cast<unsigned>(atoi(optarg));
+			break;
+		case 't':
+			top = atoi(optarg);
+			break;
+		case 'c':
+			csv_path = optarg;
+			break;
+		case 'g':
+			generate_dir = optarg;
+			break;
+		case 'n':
+			generate_count = static_cast<unsigned>(atol(optarg));
+			break;
+		default:
+			usage();
+		}
+	}
+	if (threads == 0) threads = 1;
+	if (top < 0) top = 0;
+
+	layout l;
+	if (layout_text && (!parse_layout(layout_text, l) || l.address[HIGH_SCORE] < 0)) {
+		fprintf(stderr, "-l %s: expected four addresses (high score, difficulty, games, hits)\n", layout_text);
+		return 1;
+	}
+#if EEP_FLEET_ELF
+	if (elf_path && !load_layout(elf_path, l)) {
+		fprintf(stderr, "%s: no high_score_eeprom in the symbol table\n", elf_path);
+		return 1;
+	}
+#else
+	if (elf_path) {
+		fprintf(stderr, "-e needs libelf: rebuild with make EEP_FLEET_ELF=1, or pass the addresses with -l\n");
+		return 1;
+	}
+#endif
+
+	if (generate_dir) {
+		if (!generate(generate_dir, generate_count, l)) {
+			perror(generate_dir);
+			return 1;
+		}
+		return 0;
+	}
+	if (optind >= argc) usage();
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::string> files;
+	for (int i = optind; i < argc; ++i) {
+		collect(argv[i], files);
+	}
+
+	// ファイルの番号を1つずつ取っていく。ファイルの大きさがそろっていなくても偏らない
+	hex_decoder decoder(l);
+	std::vector<cabinet> cabinets(files.size());
+	std::vector<stats> partial(threads);
+	std::atomic<size_t> next{0};
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t] {
+			stats& s = partial[t];
+			size_t i;
+			while ((i = next.fetch_add(1, std::memory_order_relaxed)) < files.size()) {
+				cabinets[i] = read_dump(files[i], decoder, s.bytes);
+				s.on_cabinet(cabinets[i]);
+			}
+		});
+	}
+	stats fleet;
+	for (unsigned t = 0; t < threads; ++t) {
+		workers[t].join();
+		fleet.merge(partial[t]);
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	print_report(fleet, files, cabinets, top, elapsed, threads);
+	if (csv_path && !write_csv(csv_path, files, cabinets)) {
+		perror(csv_path);
+		return 1;
+	}
+	return fleet.unreadable + fleet.broken > 0 ? 2 : 0;
+}
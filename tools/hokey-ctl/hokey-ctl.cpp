@@ -0,0 +1,208 @@
+/*
+  hokey-ctl: 筐体にリモートコマンドを送るツール(REMOTE_COMMAND = 1のファームウェア用)
+
+  使い方
+    hokey-ctl PORT status            ハイスコア、難易度、状態、ゲーム数、成功数を表示する
+    hokey-ctl PORT difficulty N      難易度を設定する(0: easy, 1: normal, 2: hard)
+    hokey-ctl PORT erase             ハイスコアを消去する
+    hokey-ctl PORT diagnostics       診断画面に入る
+    hokey-ctl PORT trace             イベントトレースを古い順に表示する(TRACE_DEPTHを設定したファームウェア)
+
+  コマンドの形式はcommand_protocol.h、応答の形式はtelemetry_protocol.hを参照。
+  応答の間に流れてくるテレメトリのレコードは読み飛ばす。応答が来なければ再送する。
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <functional>
+#include <vector>
+
+#include "command_protocol.h"
+#include "telemetry_protocol.h"
+#include "trace.h"
+
+namespace
+{
+	using command_protocol::command_id;
+	using telemetry_protocol::record_type;
+
+	constexpr int RETRY = 3;
+	constexpr int TIMEOUT_MS = 500;
+
+	int open_port(const char* path)
+	{
+		int fd = open(path, O_RDWR | O_NOCTTY);
+		if (fd < 0) return -1;
+		termios t;
+		if (tcgetattr(fd, &t) == 0) {
+			cfmakeraw(&t);
+			cfsetispeed(&t, B9600);
+			cfsetospeed(&t, B9600);
+			tcsetattr(fd, TCSANOW, &t);
+		}
+		return fd;
+	}
+
+	void send_command(int fd, command_id id, const std::vector<uint8_t>& argument)
+	{
+		std::vector<uint8_t> frame{command_protocol::SYNC, static_cast<uint8_t>(1 + argument.size()), static_cast<uint8_t>(id)};
+		frame.insert(frame.end(), argument.begin(), argument.end());
+		uint8_t sum = 0;
+		for (size_t i = 1; i < frame.size(); ++i) sum = static_cast<uint8_t>(sum + frame[i]);
+		frame.push_back(static_cast<uint8_t>(-sum));
+		ssize_t written = write(fd, frame.data(), frame.size());
+		(void)written;
+	}
+
+	// レコードを読んでhandlerに渡す。handlerがtrueを返したら終わる。TIMEOUT_MSの間何も来なければfalse
+	bool read_records(int fd, const std::function<bool(record_type, const uint8_t*)>& handler)
+	{
+		std::vector<uint8_t> buffer;
+		while (true) {
+			pollfd p{fd, POLLIN, 0};
+			if (poll(&p, 1, TIMEOUT_MS) <= 0) return false;
+			uint8_t chunk[64];
+			ssize_t n = read(fd, chunk, sizeof(chunk));
+			if (n <= 0) return false;
+			buffer.insert(buffer.end(), chunk, chunk + n);
+			size_t i = 0;
+			while (i < buffer.size()) {
+				if (buffer[i] != telemetry_protocol::SYNC) {
+					++i;
+					continue;
+				}
+				if (buffer.size() - i < telemetry_protocol::HEADER_SIZE + 1u) break;
+				uint8_t length = buffer[i + 1];
+				auto t = static_cast<record_type>(buffer[i + 2]);
+				if (length == 0 || telemetry_protocol::payload_size(t) != length - 1) {
+					++i;
+					continue;
+				}
+				if (buffer.size() - i < static_cast<size_t>(telemetry_protocol::HEADER_SIZE + length)) break;
+				if (handler(t, &buffer[i + 3])) return true;
+				i += telemetry_protocol::HEADER_SIZE + length;
+			}
+			buffer.erase(buffer.begin(), buffer.begin() + static_cast<long>(i));
+		}
+	}
+
+	// typeのレコードを待ってpayloadを返す
+	bool wait_record(int fd, record_type type, std::vector<uint8_t>& payload)
+	{
+		return read_records(fd, [&](record_type t, const uint8_t* p) {
+			if (t != type) return false;
+			payload.assign(p, p + telemetry_protocol::payload_size(t));
+			return true;
+		});
+	}
+
+	// traceレコードを表示しながら、dump_traceのackを待つ
+	bool dump_trace(int fd, bool& received)
+	{
+		return read_records(fd, [&](record_type t, const uint8_t* p) {
+			if (t == record_type::trace) {
+				received = true;
+				unsigned time = p[0] | p[1] << 8;
+				printf("%6u tick  %-12s %u\n", time, trace_event_name(static_cast<trace_event>(p[2])), p[3]);
+				return false;
+			}
+			if (t == record_type::ack && p[0] == static_cast<uint8_t>(command_id::dump_trace)) {
+				received = true;
+				if (p[1] != static_cast<uint8_t>(telemetry_protocol::result::ok)) {
+					printf("trace is not enabled in this firmware\n");
+				}
+				return true;
+			}
+			return false;
+		});
+	}
+
+	const char* result_name(uint8_t result)
+	{
+		switch (static_cast<telemetry_protocol::result>(result)) {
+		case telemetry_protocol::result::ok:
+			return "ok";
+		case telemetry_protocol::result::invalid:
+			return "invalid";
+		case telemetry_protocol::result::busy:
+			return "busy (playing)";
+		}
+		return "unknown";
+	}
+
+	void usage()
+	{
+		fprintf(stderr, "usage: hokey-ctl PORT status|difficulty N|erase|diagnostics|trace\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) usage();
+	command_id id;
+	std::vector<uint8_t> argument;
+	if (strcmp(argv[2], "status") == 0) {
+		id = command_id::get_status;
+	} else if (strcmp(argv[2], "difficulty") == 0 && argc == 4) {
+		id = command_id::set_difficulty;
+		argument.push_back(static_cast<uint8_t>(atoi(argv[3])));
+	} else if (strcmp(argv[2], "erase") == 0) {
+		id = command_id::erase_score;
+	} else if (strcmp(argv[2], "diagnostics") == 0) {
+		id = command_id::diagnostics;
+	} else if (strcmp(argv[2], "trace") == 0) {
+		id = command_id::dump_trace;
+	} else {
+		usage();
+	}
+
+	int fd = open_port(argv[1]);
+	if (fd < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (id == command_id::dump_trace) {
+		// 途中まで届いていたら再送しない(同じレコードが二重に表示されるので)
+		bool received = false;
+		bool done = false;
+		for (int retry = 0; retry < RETRY && !received; ++retry) {
+			tcflush(fd, TCIFLUSH);
+			send_command(fd, id, argument);
+			done = dump_trace(fd, received);
+		}
+		close(fd);
+		if (!done) {
+			fprintf(stderr, received ? "trace dump interrupted\n" : "no response\n");
+			return 1;
+		}
+		return 0;
+	}
+	record_type reply = id == command_id::get_status ? record_type::status : record_type::ack;
+	std::vector<uint8_t> payload;
+	for (int retry = 0; retry < RETRY; ++retry) {
+		tcflush(fd, TCIFLUSH);
+		send_command(fd, id, argument);
+		if (wait_record(fd, reply, payload)) break;
+		payload.clear();
+	}
+	close(fd);
+	if (payload.empty()) {
+		fprintf(stderr, "no response\n");
+		return 1;
+	}
+	if (reply == record_type::status) {
+		printf("high score: %u\ndifficulty: %u\nstate: %u\ngames: %u\nhits: %u\n",
+			payload[0], payload[1], payload[2], payload[3] | payload[4] << 8, payload[5] | payload[6] << 8);
+		return 0;
+	}
+	printf("%s\n", result_name(payload[1]));
+	return payload[1] == static_cast<uint8_t>(telemetry_protocol::result::ok) ? 0 : 1;
+}
@@ -0,0 +1,339 @@
+/*
+  hokey-upload: シリアルブートローダ(bootloader/)にファームウェアを書き込むツール
+
+  使い方
+    hokey-upload [-r] [-f] PORT avr-hokey.hex
+
+    PORT    シリアルポート、またはhokey-sim -p -Bで作った擬似端末
+    -r      DTRを一度Lowにしてリセットをかける(DTRをRESETにつないだ基板の場合)
+    -f      CRCが一致するページも含めて全ページ書き込む
+
+  ブートローダからページごとのCRCを受け取り、イメージと違うページだけを書き込む。
+  書き込みが途中で止まってもアプリが起動しないように、先頭ページは最初に消去して最後に書く。
+  書き込んだ後にもう一度CRCを読んで照合する。
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "boot_protocol.h"
+
+namespace
+{
+	// board.mkで選べるMCU。ページの大きさと数はブートローダから受け取る
+	struct mcu_signature
+	{
+		uint8_t bytes[3];
+		const char* name;
+	};
+
+	constexpr mcu_signature SIGNATURES[] {
+		{{0x1E, 0x93, 0x0A}, "ATmega88"},
+		{{0x1E, 0x93, 0x0F}, "ATmega88P"},
+		{{0x1E, 0x94, 0x06}, "ATmega168"},
+		{{0x1E, 0x94, 0x0B}, "ATmega168P"},
+		{{0x1E, 0x95, 0x0F}, "ATmega328P"},
+	};
+
+	const char* mcu_name(const uint8_t* signature)
+	{
+		for (const auto& s : SIGNATURES) {
+			if (memcmp(signature, s.bytes, 3) == 0) return s.name;
+		}
+		return nullptr;
+	}
+
+	// Intel HEXを読み、アドレス0からのイメージにする。書かれていない部分は0xFF
+	bool read_hex(const char* path, std::vector<uint8_t>& image)
+	{
+		std::ifstream in(path);
+		if (!in) return false;
+		std::string line;
+		uint32_t base = 0;
+		while (std::getline(in, line)) {
+			if (line.empty() || line[0] != ':') continue;
+			std::vector<uint8_t> bytes;
+			for (size_t i = 1; i + 1 < line.size(); i += 2) {
+				bytes.push_back(static_cast<uint8_t>(strtoul(line.substr(i, 2).c_str(), nullptr, 16)));
+			}
+			if (bytes.size() < 5 || bytes.size() != 5u + bytes[0]) return false;
+			uint8_t sum = 0;
+			for (uint8_t b : bytes) sum = static_cast<uint8_t>(sum + b);
+			if (sum != 0) return false;
+			uint32_t address = static_cast<uint32_t>(bytes[1] << 8 | bytes[2]);
+			const uint8_t* data = &bytes[4];
+			switch (bytes[3]) {
+			case 0x00:
+				address += base;
+				if (image.size() < address + bytes[0]) image.resize(address + bytes[0], 0xFF);
+				memcpy(&image[address], data, bytes[0]);
+				break;
+			case 0x01:
+				return true;
+			case 0x02:
+				base = static_cast<uint32_t>(data[0] << 8 | data[1]) << 4;
+				break;
+			case 0x04:
+				base = static_cast<uint32_t>(data[0] << 8 | data[1]) << 16;
+				break;
+			}
+		}
+		return true;
+	}
+
+	class serial_port
+	{
+	public:
+		~serial_port() {
+			if (m_fd >= 0) close(m_fd);
+		}
+
+		bool open(const char* path) {
+			m_fd = ::open(path, O_RDWR | O_NOCTTY);
+			if (m_fd < 0) return false;
+			termios t;
+			if (tcgetattr(m_fd, &t) == 0) {
+				cfmakeraw(&t);
+				cfsetispeed(&t, B38400);
+				cfsetospeed(&t, B38400);
+				tcsetattr(m_fd, TCSANOW, &t);
+			}
+			return true;
+		}
+
+		void pulse_dtr() {
+			int bits = TIOCM_DTR;
+			ioctl(m_fd, TIOCMBIS, &bits);
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			ioctl(m_fd, TIOCMBIC, &bits);
+		}
+
+		void write(const std::vector<uint8_t>& data) {
+			size_t done = 0;
+			while (done < data.size()) {
+				ssize_t n = ::write(m_fd, data.data() + done, data.size() - done);
+				if (n <= 0) return;
+				done += static_cast<size_t>(n);
+			}
+		}
+
+		// sizeバイト読む。timeout_msの間に来なければfalse
+		bool read(uint8_t* data, size_t size, int timeout_ms) {
+			size_t done = 0;
+			while (done < size) {
+				pollfd p{m_fd, POLLIN, 0};
+				if (poll(&p, 1, timeout_ms) <= 0) return false;
+				ssize_t n = ::read(m_fd, data + done, size - done);
+				if (n <= 0) return false;
+				done += static_cast<size_t>(n);
+			}
+			return true;
+		}
+
+		void flush_input() {
+			tcflush(m_fd, TCIFLUSH);
+		}
+
+	private:
+		int m_fd = -1;
+	};
+
+	class uploader
+	{
+	public:
+		explicit uploader(serial_port& port) : m_port(port) {}
+
+		// SYNCを送り続けてブートローダの応答を待つ
+		bool sync() {
+			for (int retry = 0; retry < 60; ++retry) {
+				m_port.write({boot_protocol::SYNC});
+				uint8_t info[7];
+				if (m_port.read(info, 1, 50) && info[0] == boot_protocol::INFO && m_port.read(info + 1, 6, 500) && info[6] == boot_protocol::OK) {
+					const char* name = mcu_name(info + 1);
+					if (!name) {
+						fprintf(stderr, "unexpected signature %02x %02x %02x\n", info[1], info[2], info[3]);
+						return false;
+					}
+					printf("target: %s\n", name);
+					m_page_size = info[4];
+					m_page_count = info[5];
+					m_port.flush_input();
+					return true;
+				}
+			}
+			fprintf(stderr, "no response from bootloader\n");
+			return false;
+		}
+
+		bool read_crcs(std::vector<uint16_t>& crcs) {
+			m_port.write({boot_protocol::CRC});
+			std::vector<uint8_t> data(m_page_count * 2u + 1);
+			if (!m_port.read(data.data(), data.size(), 2000) || data.back() != boot_protocol::OK) return false;
+			crcs.resize(m_page_count);
+			for (size_t i = 0; i < m_page_count; ++i) {
+				crcs[i] = static_cast<uint16_t>(data[i * 2] | data[i * 2 + 1] << 8);
+			}
+			return true;
+		}
+
+		bool write_page(uint8_t page, const uint8_t* data) {
+			std::vector<uint8_t> packet{boot_protocol::WRITE, page};
+			uint16_t crc = 0;
+			for (size_t i = 0; i < m_page_size; ++i) {
+				packet.push_back(data[i]);
+				crc = boot_protocol::crc_update(crc, data[i]);
+			}
+			packet.push_back(static_cast<uint8_t>(crc));
+			packet.push_back(static_cast<uint8_t>(crc >> 8));
+			m_port.write(packet);
+			uint8_t reply;
+			return m_port.read(&reply, 1, 1000) && reply == boot_protocol::OK;
+		}
+
+		bool exit() {
+			m_port.write({boot_protocol::EXIT});
+			uint8_t reply;
+			return m_port.read(&reply, 1, 1000) && reply == boot_protocol::OK;
+		}
+
+		size_t page_size() const {
+			return m_page_size;
+		}
+
+		size_t page_count() const {
+			return m_page_count;
+		}
+
+	private:
+		serial_port& m_port;
+		size_t m_page_size = 0;
+		size_t m_page_count = 0;
+	};
+
+	uint16_t page_crc(const std::vector<uint8_t>& image, size_t offset, size_t size)
+	{
+		uint16_t crc = 0;
+		for (size_t i = 0; i < size; ++i) {
+			crc = boot_protocol::crc_update(crc, image[offset + i]);
+		}
+		return crc;
+	}
+
+	void usage()
+	{
+		fprintf(stderr, "usage: hokey-upload [-r] [-f] PORT image.hex\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	bool reset = false;
+	bool force = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "rf")) != -1) {
+		switch (opt) {
+		case 'r':
+			reset = true;
+			break;
+		case 'f':
+			force = true;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind + 2 != argc) usage();
+
+	std::vector<uint8_t> image;
+	if (!read_hex(argv[optind + 1], image)) {
+		fprintf(stderr, "%s: cannot read Intel HEX\n", argv[optind + 1]);
+		return 1;
+	}
+	serial_port port;
+	if (!port.open(argv[optind])) {
+		perror(argv[optind]);
+		return 1;
+	}
+	auto start = std::chrono::steady_clock::now();
+	if (reset) port.pulse_dtr();
+
+	uploader up(port);
+	if (!up.sync()) return 1;
+	size_t app_size = up.page_size() * up.page_count();
+	if (image.size() > app_size) {
+		fprintf(stderr, "image (%zu bytes) does not fit in the application section (%zu bytes)\n", image.size(), app_size);
+		return 1;
+	}
+	size_t image_pages = (image.size() + up.page_size() - 1) / up.page_size();
+	image.resize(image_pages * up.page_size(), 0xFF);
+
+	std::vector<uint16_t> device_crcs;
+	if (!up.read_crcs(device_crcs)) {
+		fprintf(stderr, "cannot read page CRCs\n");
+		return 1;
+	}
+	std::vector<uint8_t> changed;
+	for (size_t page = 0; page < image_pages; ++page) {
+		if (force || page_crc(image, page * up.page_size(), up.page_size()) != device_crcs[page]) {
+			changed.push_back(static_cast<uint8_t>(page));
+		}
+	}
+
+	size_t writes = 0;
+	bool ok = true;
+	if (!changed.empty()) {
+		// 先頭ページは最初に消去し、最後に書く
+		std::vector<uint8_t> blank(up.page_size(), 0xFF);
+		bool multi = changed.size() > 1 || changed[0] != 0;
+		if (multi) {
+			ok = up.write_page(0, blank.data());
+			++writes;
+		}
+		for (size_t i = 0; ok && i < changed.size(); ++i) {
+			if (changed[i] == 0) continue;
+			ok = up.write_page(changed[i], &image[changed[i] * up.page_size()]);
+			++writes;
+		}
+		if (ok) {
+			ok = up.write_page(0, &image[0]);
+			++writes;
+		}
+	}
+	if (!ok) {
+		fprintf(stderr, "write failed\n");
+		return 1;
+	}
+
+	std::vector<uint16_t> verify_crcs;
+	if (!up.read_crcs(verify_crcs)) {
+		fprintf(stderr, "cannot read page CRCs for verification\n");
+		return 1;
+	}
+	for (size_t page = 0; page < image_pages; ++page) {
+		if (verify_crcs[page] != page_crc(image, page * up.page_size(), up.page_size())) {
+			fprintf(stderr, "verification failed at page %zu\n", page);
+			return 1;
+		}
+	}
+	if (!up.exit()) {
+		fprintf(stderr, "bootloader did not acknowledge exit\n");
+		return 1;
+	}
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%zu of %zu pages changed, %zu page writes, %.2f s\n", changed.size(), image_pages, writes, sec);
+	return 0;
+}
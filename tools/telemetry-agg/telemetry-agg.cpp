@@ -0,0 +1,510 @@
+/*
+  telemetry-agg: 複数の筐体から来るテレメトリを集計するツール
+
+  使い方
+    telemetry-agg [オプション] STREAM...
+
+    STREAM          シリアルポート(9600bps)、擬似端末(hokey-sim -pで作ったものなど)、または記録したファイル
+    -j N            受信スレッド数。既定はコア数
+    -i SEC          集計結果を表示する間隔。既定は10秒
+    -v              筐体ごとの集計も表示する
+    -b UNITS        ベンチマーク。UNITS台分の合成データをパイプで流し込み、処理速度を測る
+    -n EVENTS       ベンチマークで1台あたりに流すレコード数。既定は100000
+
+  レコードの形式はtelemetry_protocol.hを参照。
+  受信スレッドは担当するストリームをepollで待ち、読み込んだバッファの上で直接レコードを
+  切り出す(コピーするのはバッファ末尾の切れたレコードだけ)。集計値はストリームごとに持ち、
+  表示するときに受信スレッドのロックを短時間取って合計する。
+  直近1時間の値は1分ごとのバケツで持っている。
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "telemetry_protocol.h"
+
+namespace
+{
+	using telemetry_protocol::record_type;
+
+	constexpr int WINDOW_MINUTES = 60;
+	constexpr int SCORE_BUCKETS = 10;    // スコア10点ごと
+	constexpr int SPEED_BUCKETS = 8;    // 速さ5ティックごと
+	constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+	std::atomic<bool> stop_requested{false};
+
+	uint64_t now_minute()
+	{
+		using namespace std::chrono;
+		return static_cast<uint64_t>(duration_cast<minutes>(steady_clock::now().time_since_epoch()).count());
+	}
+
+	// 集計値。筐体ごとに持ち、全体の値はこれを足し合わせて作る
+	struct stats
+	{
+		uint64_t events = 0;
+		uint64_t broken = 0;    // 形式の合わないレコード
+		uint64_t starts = 0;
+		uint64_t games = 0;    // 終わったゲーム数
+		uint64_t score_sum = 0;
+		uint64_t hits = 0;
+		uint64_t offset_sum = 0;
+		uint64_t high_scores = 0;
+		uint8_t max_score = 0;
+		uint64_t fail_score[SCORE_BUCKETS] = {};
+		uint64_t fail_speed[SPEED_BUCKETS] = {};
+
+		// 直近1時間。minuteが現在から60分以内のバケツだけが有効
+		uint64_t bucket_minute[WINDOW_MINUTES] = {};
+		uint32_t bucket_games[WINDOW_MINUTES] = {};
+		uint64_t bucket_score[WINDOW_MINUTES] = {};
+
+		void on_record(record_type type, const uint8_t* payload, uint64_t minute) {
+			++events;
+			switch (type) {
+			case record_type::game_start:
+				++starts;
+				break;
+			case record_type::hit:
+				++hits;
+				offset_sum += payload[1];
+				break;
+			case record_type::game_over: {
+				uint8_t score = payload[0];
+				++games;
+				score_sum += score;
+				if (score > max_score) max_score = score;
+				++fail_score[score / 10 < SCORE_BUCKETS ? score / 10 : SCORE_BUCKETS - 1];
+				++fail_speed[payload[1] / 5 < SPEED_BUCKETS ? payload[1] / 5 : SPEED_BUCKETS - 1];
+				int b = static_cast<int>(minute % WINDOW_MINUTES);
+				if (bucket_minute[b] != minute) {
+					bucket_minute[b] = minute;
+					bucket_games[b] = 0;
+					bucket_score[b] = 0;
+				}
+				++bucket_games[b];
+				bucket_score[b] += score;
+				break;
+			}
+			case record_type::high_score:
+				++high_scores;
+				break;
+			case record_type::ack:
+			case record_type::status:
+			case record_type::trace:
+				break;    // リモートコマンドの応答は集計しない
+			}
+		}
+
+		void merge(const stats& s) {
+			events += s.events;
+			broken += s.broken;
+			starts += s.starts;
+			games += s.games;
+			score_sum += s.score_sum;
+			hits += s.hits;
+			offset_sum += s.offset_sum;
+			high_scores += s.high_scores;
+			if (s.max_score > max_score) max_score = s.max_score;
+			for (int i = 0; i < SCORE_BUCKETS; ++i) fail_score[i] += s.fail_score[i];
+			for (int i = 0; i < SPEED_BUCKETS; ++i) fail_speed[i] += s.fail_speed[i];
+		}
+
+		void window(uint64_t minute, uint64_t& games_out, uint64_t& score_out) const {
+			games_out = 0;
+			score_out = 0;
+			for (int i = 0; i < WINDOW_MINUTES; ++i) {
+				if (bucket_minute[i] + WINDOW_MINUTES > minute && bucket_minute[i] <= minute && bucket_games[i] != 0) {
+					games_out += bucket_games[i];
+					score_out += bucket_score[i];
+				}
+			}
+		}
+	};
+
+	// 1台分の入力
+	struct stream
+	{
+		std::string name;
+		int fd = -1;
+		bool pollable = true;    // 通常のファイルはepollで待てない
+		size_t size = 0;    // bufferの有効なバイト数
+		uint8_t buffer[BUFFER_SIZE];
+		stats total;
+
+		// bufferの先頭から切り出せるだけレコードを切り出す。残りは先頭に詰める
+		void parse(uint64_t minute) {
+			const uint8_t* p = buffer;
+			const uint8_t* end = buffer + size;
+			while (p < end) {
+				if (*p != telemetry_protocol::SYNC) {
+					const uint8_t* sync = static_cast<const uint8_t*>(memchr(p, telemetry_protocol::SYNC, static_cast<size_t>(end - p)));
+					if (!sync) {
+						p = end;
+						break;
+					}
+					p = sync;
+				}
+				if (end - p < telemetry_protocol::HEADER_SIZE + 1) break;
+				uint8_t length = p[1];
+				auto type = static_cast<record_type>(p[2]);
+				if (length == 0 || telemetry_protocol::payload_size(type) != length - 1) {
+					// 同期が外れている。次のSYNCから探し直す
+					++total.broken;
+					++p;
+					continue;
+				}
+				if (end - p < telemetry_protocol::HEADER_SIZE + length) break;
+				total.on_record(type, p + telemetry_protocol::HEADER_SIZE + 1, minute);
+				p += telemetry_protocol::HEADER_SIZE + length;
+			}
+			size = static_cast<size_t>(end - p);
+			if (size > 0 && p != buffer) {
+				memmove(buffer, p, size);
+			}
+		}
+
+		// 読めるだけ読む。終端に達したらfalse
+		bool drain(uint64_t minute) {
+			while (true) {
+				ssize_t n = read(fd, buffer + size, BUFFER_SIZE - size);
+				if (n > 0) {
+					size += static_cast<size_t>(n);
+					parse(minute);
+					if (size == BUFFER_SIZE) size = 0;    // SYNCのないゴミで埋まった
+					continue;
+				}
+				if (n < 0 && (errno == EAGAIN || errno == EINTR)) return true;
+				return false;
+			}
+		}
+	};
+
+	// 受信スレッド。担当するストリームの集計値はこのスレッドだけが書き換える
+	class worker
+	{
+	public:
+		void add(stream* s) {
+			m_streams.push_back(s);
+		}
+
+		void start() {
+			m_thread = std::thread(&worker::run, this);
+		}
+
+		void join() {
+			m_thread.join();
+		}
+
+		bool finished() const {
+			return m_finished;
+		}
+
+		// 集計値と直近1時間の値を足し込む
+		void collect(stats& fleet, uint64_t minute, bool verbose, uint64_t& window_games, uint64_t& window_score) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (stream* s : m_streams) {
+				fleet.merge(s->total);
+				uint64_t games, score;
+				s->total.window(minute, games, score);
+				window_games += games;
+				window_score += score;
+				if (verbose) {
+					printf("  %-24s games=%llu avg=%.1f max=%u games/h=%llu hits=%llu broken=%llu\n",
+						s->name.c_str(),
+						static_cast<unsigned long long>(s->total.games),
+						s->total.games ? static_cast<double>(s->total.score_sum) / static_cast<double>(s->total.games) : 0.0,
+						s->total.max_score,
+						static_cast<unsigned long long>(games),
+						static_cast<unsigned long long>(s->total.hits),
+						static_cast<unsigned long long>(s->total.broken));
+				}
+			}
+		}
+
+	private:
+		void run() {
+			uint64_t minute = now_minute();
+			int epfd = epoll_create1(0);
+			int active = 0;
+			for (stream* s : m_streams) {
+				if (!s->pollable) {
+					std::lock_guard<std::mutex> lock(m_mutex);
+					s->drain(minute);
+					close(s->fd);
+					s->fd = -1;
+					continue;
+				}
+				epoll_event ev{};
+				ev.events = EPOLLIN;
+				ev.data.ptr = s;
+				epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev);
+				++active;
+			}
+			epoll_event events[64];
+			while (active > 0 && !stop_requested) {
+				int n = epoll_wait(epfd, events, 64, 100);
+				if (n <= 0) continue;
+				minute = now_minute();
+				std::lock_guard<std::mutex> lock(m_mutex);
+				for (int i = 0; i < n; ++i) {
+					stream* s = static_cast<stream*>(events[i].data.ptr);
+					if (!s->drain(minute) || (events[i].events & (EPOLLHUP | EPOLLERR))) {
+						epoll_ctl(epfd, EPOLL_CTL_DEL, s->fd, nullptr);
+						close(s->fd);
+						s->fd = -1;
+						--active;
+					}
+				}
+			}
+			close(epfd);
+			m_finished = true;
+		}
+
+		std::vector<stream*> m_streams;
+		std::mutex m_mutex;
+		std::thread m_thread;
+		std::atomic<bool> m_finished{false};
+	};
+
+	void print_report(std::vector<std::unique_ptr<worker>>& workers, bool verbose, double elapsed_sec)
+	{
+		stats fleet;
+		uint64_t minute = now_minute();
+		uint64_t window_games = 0, window_score = 0;
+		if (verbose) printf("units:\n");
+		for (auto& w : workers) {
+			w->collect(fleet, minute, verbose, window_games, window_score);
+		}
+		printf("fleet: events=%llu (%.0f/s) games=%llu avg_score=%.2f max=%u games/h=%llu avg_score/h=%.2f hits=%llu avg_offset=%.1f high_scores=%llu broken=%llu\n",
+			static_cast<unsigned long long>(fleet.events),
+			elapsed_sec > 0 ? static_cast<double>(fleet.events) / elapsed_sec : 0.0,
+			static_cast<unsigned long long>(fleet.games),
+			fleet.games ? static_cast<double>(fleet.score_sum) / static_cast<double>(fleet.games) : 0.0,
+			fleet.max_score,
+			static_cast<unsigned long long>(window_games),
+			window_games ? static_cast<double>(window_score) / static_cast<double>(window_games) : 0.0,
+			static_cast<unsigned long long>(fleet.hits),
+			fleet.hits ? static_cast<double>(fleet.offset_sum) / static_cast<double>(fleet.hits) : 0.0,
+			static_cast<unsigned long long>(fleet.high_scores),
+			static_cast<unsigned long long>(fleet.broken));
+		printf("fail score:");
+		for (int i = 0; i < SCORE_BUCKETS; ++i) {
+			printf(" %d-:%llu", i * 10, static_cast<unsigned long long>(fleet.fail_score[i]));
+		}
+		printf("\nfail speed:");
+		for (int i = 0; i < SPEED_BUCKETS; ++i) {
+			printf(" %d-:%llu", i * 5, static_cast<unsigned long long>(fleet.fail_speed[i]));
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	bool open_stream(stream& s)
+	{
+		s.fd = open(s.name.c_str(), O_RDONLY | O_NOCTTY | O_NONBLOCK);
+		if (s.fd < 0) return false;
+		struct stat st;
+		fstat(s.fd, &st);
+		s.pollable = !S_ISREG(st.st_mode);
+		if (isatty(s.fd)) {
+			termios t;
+			tcgetattr(s.fd, &t);
+			cfmakeraw(&t);
+			cfsetispeed(&t, B9600);
+			cfsetospeed(&t, B9600);
+			tcsetattr(s.fd, TCSANOW, &t);
+		}
+		return true;
+	}
+
+	// ベンチマーク用の合成データ。実機と同じ並びでゲームを繰り返す
+	std::vector<uint8_t> synthetic_stream(unsigned seed, size_t events)
+	{
+		std::vector<uint8_t> data;
+		size_t count = 0;
+		while (count < events) {
+			data.insert(data.end(), {telemetry_protocol::SYNC, 1, static_cast<uint8_t>(record_type::game_start)});
+			++count;
+			uint8_t score = 0;
+			uint8_t speed = 30;
+			while (count < events && (seed = seed * 1103515245 + 12345) % 100 > score / 2u + 5) {
+				++score;
+				speed = static_cast<uint8_t>(speed > 6 ? speed - 1 : speed);
+				uint8_t offset = static_cast<uint8_t>((seed >> 16) % (speed * 3));
+				data.insert(data.end(), {telemetry_protocol::SYNC, 4, static_cast<uint8_t>(record_type::hit), score, offset, speed});
+				++count;
+			}
+			data.insert(data.end(), {telemetry_protocol::SYNC, 3, static_cast<uint8_t>(record_type::game_over), score, speed});
+			++count;
+		}
+		return data;
+	}
+
+	void usage()
+	{
+		fprintf(stderr, "usage: telemetry-agg [-j threads] [-i sec] [-v] STREAM...\n"
+			"       telemetry-agg [-j threads] -b units [-n events]\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	int interval_sec = 10;
+	bool verbose = false;
+	unsigned bench_units = 0;
+	size_t bench_events = 100000;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "j:i:vb:n:")) != -1) {
+		switch (opt) {
+		case 'j':
+			threads = static_cast<unsigned>(atoi(optarg));
+			break;
+		case 'i':
+			interval_sec = atoi(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'b':
+			bench_units = static_cast<unsigned>(atoi(optarg));
+			break;
+		case 'n':
+			bench_events = static_cast<size_t>(atol(optarg));
+			break;
+		default:
+			usage();
+		}
+	}
+	if (threads == 0) threads = 1;
+	if (bench_units == 0 && optind >= argc) usage();
+
+	signal(SIGINT, [](int) { stop_requested = true; });
+	signal(SIGPIPE, SIG_IGN);
+
+	// ストリームを開く。ベンチマークではパイプの読み出し側をストリームにする
+	std::vector<std::unique_ptr<stream>> streams;
+	std::vector<int> bench_writers;
+	if (bench_units > 0) {
+		for (unsigned i = 0; i < bench_units; ++i) {
+			int fds[2];
+			if (pipe(fds) < 0) {
+				perror("pipe");
+				return 1;
+			}
+			fcntl(fds[0], F_SETFL, O_NONBLOCK);
+			std::unique_ptr<stream> s(new stream);
+			s->name = "bench" + std::to_string(i);
+			s->fd = fds[0];
+			streams.push_back(std::move(s));
+			bench_writers.push_back(fds[1]);
+		}
+	} else {
+		for (int i = optind; i < argc; ++i) {
+			std::unique_ptr<stream> s(new stream);
+			s->name = argv[i];
+			if (!open_stream(*s)) {
+				perror(argv[i]);
+				return 1;
+			}
+			streams.push_back(std::move(s));
+		}
+	}
+
+	if (threads > streams.size()) threads = static_cast<unsigned>(streams.size());
+	std::vector<std::unique_ptr<worker>> workers;
+	for (unsigned i = 0; i < threads; ++i) {
+		workers.emplace_back(new worker);
+	}
+	for (size_t i = 0; i < streams.size(); ++i) {
+		workers[i % threads]->add(streams[i].get());
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (auto& w : workers) {
+		w->start();
+	}
+
+	// ベンチマークのデータを書き込むスレッド
+	std::vector<std::thread> generators;
+	if (bench_units > 0) {
+		unsigned generator_count = threads;
+		for (unsigned g = 0; g < generator_count; ++g) {
+			generators.emplace_back([&, g]() {
+				std::vector<std::vector<uint8_t>> data;
+				std::vector<size_t> written;
+				std::vector<int> fds;
+				for (size_t i = g; i < bench_writers.size(); i += generator_count) {
+					data.push_back(synthetic_stream(static_cast<unsigned>(i), bench_events));
+					written.push_back(0);
+					fds.push_back(bench_writers[i]);
+				}
+				bool remaining = true;
+				while (remaining) {
+					remaining = false;
+					for (size_t i = 0; i < fds.size(); ++i) {
+						if (written[i] == data[i].size()) continue;
+						size_t chunk = std::min<size_t>(16384, data[i].size() - written[i]);
+						ssize_t n = write(fds[i], data[i].data() + written[i], chunk);
+						if (n > 0) written[i] += static_cast<size_t>(n);
+						if (written[i] == data[i].size()) {
+							close(fds[i]);
+						} else {
+							remaining = true;
+						}
+					}
+				}
+			});
+		}
+	}
+
+	auto elapsed = [&start]() {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+	auto all_finished = [&workers]() {
+		for (auto& w : workers) {
+			if (!w->finished()) return false;
+		}
+		return true;
+	};
+
+	double next_report = interval_sec;
+	while (!all_finished() && !stop_requested) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(bench_units > 0 ? 1 : 100));
+		if (bench_units == 0 && elapsed() >= next_report) {
+			print_report(workers, verbose, elapsed());
+			next_report += interval_sec;
+		}
+	}
+	double total_sec = elapsed();
+	for (auto& g : generators) {
+		g.join();
+	}
+	for (auto& w : workers) {
+		w->join();
+	}
+	print_report(workers, verbose, total_sec);
+	return 0;
+}
@@ -0,0 +1,139 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+  RAM上のイベントトレース
+
+  状態遷移、スイッチの変化、成功、EEPROMへの書き込みなどを、時刻(ティック数の下位16ビット)と
+  一緒にリングバッファに記録する。古いものから上書きする。
+  記録はレコード1つ(4バイト)のコピーとインデックスの更新だけで、約20サイクル。
+  TRACE_DEPTH = 0のときは何もしないクラスになり、記録のコードはすべて消える。
+
+  読み出し方
+    ・GDB: p trace_buffer (m_headが次に書く位置。その位置から順に古い)
+    ・シミュレータ: hokey-sim -T
+    ・UART: REMOTE_COMMANDが有効ならhokey-ctl PORT trace
+ */
+
+#include <stdint.h>
+
+#include "config.h"
+
+// 記録するイベント。0は未使用のレコード
+enum class trace_event : uint8_t
+{
+	none = 0,
+	state = 1,    // arg: 遷移先のgame_state
+	switches = 2,    // arg: スイッチの状態(bit0: ゲーム, bit1: ハイスコア表示, bit2: 消去。1が押している)
+	hit = 3,    // arg: 加算後のスコア
+	game_over = 4,    // arg: スコア
+	eeprom_write = 5,    // arg: 書き込んだ値
+	command = 6,    // arg: 受け付けたcommand_id
+	reset = 7,    // arg: リセット要因(MCUSR)。ウォッチドッグのリセットから再開したときはbit7も立てる
+	power_fail = 8,    // arg: EEPROMに書いたバイト数
+	versus_point = 9,    // arg: 自分の点 × 10 + 相手の点
+	versus_abort = 10,    // arg: versus_abort_reason
+	self_test = 11,    // arg: 自己診断の異常コード(self_test_fault)
+};
+
+// versus_abortの理由
+enum class versus_abort_reason : uint8_t
+{
+	remote = 0,    // 相手が中断した
+	desync = 1,    // 入力の番号が飛んだ
+	timeout = 2,    // 相手の入力が届かない
+};
+
+// 1レコード。ホスト側(hokey-sim, hokey-ctl)もこの並びで読む
+struct trace_record
+{
+	uint16_t time;
+	trace_event event;
+	uint8_t arg;
+};
+
+static_assert(sizeof(trace_record) == 4, "trace_record must be packed into 4 bytes.");
+
+// 表示用。ホスト側のツールで使う
+inline const char* trace_event_name(trace_event event)
+{
+	switch (event) {
+	case trace_event::none:
+		return "none";
+	case trace_event::state:
+		return "state";
+	case trace_event::switches:
+		return "switches";
+	case trace_event::hit:
+		return "hit";
+	case trace_event::game_over:
+		return "game_over";
+	case trace_event::eeprom_write:
+		return "eeprom_write";
+	case trace_event::command:
+		return "command";
+	case trace_event::reset:
+		return "reset";
+	case trace_event::power_fail:
+		return "power_fail";
+	case trace_event::versus_point:
+		return "versus_point";
+	case trace_event::versus_abort:
+		return "versus_abort";
+	case trace_event::self_test:
+		return "self_test";
+	}
+	return "unknown";
+}
+
+#if TRACE_DEPTH
+
+template <uint8_t Depth>
+class trace_ring
+{
+	static_assert(Depth >= 2 && (Depth & (Depth - 1)) == 0, "trace depth must be a power of 2.");
+public:
+	void record(uint16_t time, trace_event event, uint8_t arg) {
+		trace_record& r = m_records[m_head];
+		r.time = time;
+		r.event = event;
+		r.arg = arg;
+		m_head = static_cast<uint8_t>((m_head + 1) & (Depth - 1));
+	}
+
+	// 次に書く位置。ここから順に古いレコードが並ぶ
+	uint8_t head() const {
+		return m_head;
+	}
+
+	// indexはDepthで折り返す
+	const trace_record& at(uint8_t index) const {
+		return m_records[index & (Depth - 1)];
+	}
+
+	static constexpr uint8_t depth() {
+		return Depth;
+	}
+
+private:
+	// hokey-simはシンボルの大きさからDepthを求めるので、メンバの並びを変えないこと
+	trace_record m_records[Depth];
+	uint8_t m_head = 0;
+};
+
+using trace_buffer_type = trace_ring<TRACE_DEPTH>;
+
+#else
+
+class trace_buffer_type
+{
+public:
+	void record(uint16_t, trace_event, uint8_t) {}
+	static constexpr uint8_t depth() {
+		return 0;
+	}
+};
+
+#endif
+
+#endif
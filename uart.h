@@ -0,0 +1,106 @@
+#ifndef UART_H
+#define UART_H
+
+/*
+  割り込み駆動のUART
+
+  送信データはリングバッファに積み、UDRE割り込みで1バイトずつ送る。
+  UBRR0はクロックを切り替えるときにclock_profileが設定し直すが、送信中のバイトが
+  壊れないように、送信中はclock_profileで全速を保持し、最後のバイトが送り終わった
+  (TXC割り込み)ところで解放する。
+  受信はRX割り込みで1バイトずつ受け取る(enable_receive)。受信を有効にしたら全速を保持したままにする。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+
+#include "power_profile.h"
+#include "clock_profile.h"
+
+class uart_port
+{
+public:
+	void init() {
+		power_profile::instance().acquire(peripheral::usart0);
+		UBRR0 = clock_profile::instance().uart_ubrr();
+		UCSR0A = _BV(U2X0);
+		UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);    // 8N1
+		UCSR0B = _BV(TXEN0);
+	}
+
+	// バッファに積む。入りきらないときは何も積まずにfalseを返す
+	// 割り込み禁止中(割り込みハンドラの中)から呼ぶこと
+	bool write(const uint8_t* data, uint8_t size) {
+		uint8_t head = m_tx_head;
+		if (static_cast<uint8_t>(TX_SIZE - 1 - static_cast<uint8_t>((head - m_tx_tail) & TX_MASK)) < size) {
+			++m_dropped;
+			return false;
+		}
+		for (uint8_t i = 0; i < size; ++i) {
+			m_tx_buffer[head] = data[i];
+			head = static_cast<uint8_t>((head + 1) & TX_MASK);
+		}
+		m_tx_head = head;
+		if (!m_holding_clock) {
+			m_holding_clock = true;
+			clock_profile::instance().hold_full();
+		}
+		UCSR0B = static_cast<uint8_t>((UCSR0B & ~_BV(TXCIE0)) | _BV(UDRIE0));
+		return true;
+	}
+
+	// 受信割り込みを有効にする。いつ届くか分からないので、以後はクロックを全速のままにする
+	// (受信中にUBRR0を書き直すと、ボーレートのプリスケーラが戻って受信中のバイトが壊れる)
+	void enable_receive() {
+		clock_profile::instance().hold_full();
+		UCSR0B = static_cast<uint8_t>(UCSR0B | _BV(RXEN0) | _BV(RXCIE0));
+	}
+
+	// USART_RX_vectから呼ぶ。フレーミングエラーかオーバーランがあればfalse
+	bool receive(uint8_t& data) {
+		uint8_t status = UCSR0A;
+		data = UDR0;
+		return (status & (_BV(FE0) | _BV(DOR0))) == 0;
+	}
+
+	// 入りきらずに捨てた回数
+	uint8_t dropped() const {
+		return m_dropped;
+	}
+
+	// USART_UDRE_vectから呼ぶ
+	void on_data_register_empty() {
+		uint8_t tail = m_tx_tail;
+		// TXCは送信完了時に立つフラグ。前の送信の分が残っているので消しておく
+		UCSR0A = static_cast<uint8_t>(UCSR0A | _BV(TXC0));
+		UDR0 = m_tx_buffer[tail];
+		tail = static_cast<uint8_t>((tail + 1) & TX_MASK);
+		m_tx_tail = tail;
+		if (tail == m_tx_head) {
+			UCSR0B = static_cast<uint8_t>((UCSR0B & ~_BV(UDRIE0)) | _BV(TXCIE0));
+		}
+	}
+
+	// USART_TX_vectから呼ぶ。最後のバイトが出きったのでクロックを解放してよい
+	void on_transmit_complete() {
+		UCSR0B = static_cast<uint8_t>(UCSR0B & ~_BV(TXCIE0));
+		if (m_holding_clock) {
+			m_holding_clock = false;
+			clock_profile::instance().release_full();
+		}
+	}
+
+private:
+	static constexpr uint8_t TX_SIZE = 64;    // 2の累乗
+	static constexpr uint8_t TX_MASK = TX_SIZE - 1;
+	static_assert((TX_SIZE & TX_MASK) == 0, "TX_SIZE must be a power of 2.");
+
+	uint8_t m_tx_buffer[TX_SIZE];
+	uint8_t m_tx_head = 0;    // 次に書く位置
+	uint8_t m_tx_tail = 0;    // 次に送る位置
+	uint8_t m_dropped = 0;
+	bool m_holding_clock = false;
+};
+
+#endif
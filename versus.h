@@ -0,0 +1,314 @@
+#ifndef VERSUS_H
+#define VERSUS_H
+
+/*
+  2台の筐体をUARTでつないだ対戦モード(VERSUS = 1のとき)
+
+  配線: 互いのTXD(PD1)を相手のRXD(PD0)に、GND同士をつなぐ
+
+  ロックステップ
+    どちらの筐体も、両方のゲームスイッチの入力から同じ対戦(versus_match)を1フレーム(約2ms)ずつ
+    計算する。乱数の種、難易度、入力が同じなので、得点の判定は両方で必ず一致する。
+    表示するのは自分の側のバーだけ。
+  入力の遅延(遅延の補償)
+    フレームsで読んだ自分のスイッチは、ステップs + INPUT_DELAYの入力として相手に送り、自分も
+    そのステップで使う。相手の入力はINPUT_DELAYフレーム(約2ms × INPUT_DELAY)先の分まで
+    届いていればよいので、通信の遅れがそれより短ければ一度も待たずに進む。
+    長いときは届くまでそのステップを進めない(両方の筐体が同じだけ遅れる)。どちらの場合も
+    計算に使う入力は同じなので、遅れで得点の判定が変わることはない。
+    相手の入力が届かないままLINK_TIMEOUT_FRAMES続いたら、接続が切れたとみなして中断する。
+  通信量
+    対戦中に送るのは1フレームに入力1バイトだけ。バイトの形式はversus_protocol.hを参照。
+
+  ホストでの確かめ方: sim/Makefileのversus(hokey-simを2つ、擬似端末でつないで動かす)
+ */
+
+#include <stdint.h>
+
+#include "config.h"
+#include "clock_profile.h"
+#include "versus_protocol.h"
+
+#if VERSUS
+
+#include "uart.h"
+
+// 1フレーム(約2ms)に1バイトを送りきれること
+static_assert(UART_BAUD * BASE_TICK_COUNTS / TIMER_HZ >= 10, "the link must carry one byte per frame.");
+
+// 入力のやりとり
+class versus_link
+{
+public:
+	static constexpr uint8_t INPUT_DELAY = VERSUS_INPUT_DELAY;
+	static constexpr uint16_t LINK_TIMEOUT_FRAMES = 250;    // 約0.5秒
+
+	versus_link(uart_port& port) : m_port(port) {}
+
+	// 招待、受諾、中断を送る
+	void send_control(uint8_t byte) {
+		m_port.write(&byte, 1);
+	}
+
+	// 受け取った招待、受諾、中断。前に受け取ったものは上書きされる
+	bool take_control(uint8_t& byte) {
+		if (!m_has_control) return false;
+		m_has_control = false;
+		byte = m_control;
+		return true;
+	}
+
+	void discard_control() {
+		m_has_control = false;
+	}
+
+	// 対戦を始める。最初のINPUT_DELAYステップはどちらも離していたことにする
+	void start() {
+		m_step = 0;
+		m_remote_next = INPUT_DELAY;
+		m_local_bits = 0;
+		m_remote_bits = 0;
+		m_waiting = 0;
+		m_stalls = 0;
+		m_min_slack = WINDOW;
+		m_desync = false;
+		m_running = true;
+	}
+
+	void stop() {
+		m_running = false;
+	}
+
+	// USART_RX_vectから呼ぶ
+	void on_receive(uint8_t byte) {
+		using namespace versus_protocol;
+		if (!is_input(byte)) {
+			m_control = byte;
+			m_has_control = true;
+			return;
+		}
+		if (!m_running) return;
+		if (input_step(byte) != (m_remote_next & STEP_MASK) || static_cast<uint16_t>(m_remote_next - m_step) >= WINDOW) {
+			m_desync = true;
+			return;
+		}
+		m_remote_bits = write_bit(m_remote_bits, m_remote_next, input_pressed(byte));
+		++m_remote_next;
+	}
+
+	// 1フレームに1回呼ぶ。今のステップの相手の入力が届いていなければfalseを返し、ステップを進めない。
+	// 進めるときは、pressedをINPUT_DELAYステップ先の入力として送り、今のステップの両方の入力を返す
+	bool exchange(bool pressed, bool& local, bool& remote) {
+		uint16_t slack = static_cast<uint16_t>(m_remote_next - m_step);
+		if (slack == 0) {
+			++m_waiting;
+			if (m_stalls != 0xFF) ++m_stalls;
+			return false;
+		}
+		m_waiting = 0;
+		if (slack < m_min_slack) m_min_slack = static_cast<uint8_t>(slack);
+		uint16_t ahead = static_cast<uint16_t>(m_step + INPUT_DELAY);
+		m_local_bits = write_bit(m_local_bits, ahead, pressed);
+		uint8_t byte = versus_protocol::input(ahead, pressed);
+		m_port.write(&byte, 1);
+		local = read_bit(m_local_bits, m_step);
+		remote = read_bit(m_remote_bits, m_step);
+		++m_step;
+		return true;
+	}
+
+	// 相手の入力を続けて待っているフレーム数
+	uint16_t waiting() const {
+		return m_waiting;
+	}
+
+	// 入力の番号が飛んだ
+	bool desync() const {
+		return m_desync;
+	}
+
+	// 対戦中に待ったフレーム数(255で止まる)
+	uint8_t stalls() const {
+		return m_stalls;
+	}
+
+	// 相手の入力が何ステップ先まで届いていたかの最小値。INPUT_DELAYから通信の遅れ(フレーム)を引いた値
+	uint8_t min_slack() const {
+		return m_min_slack;
+	}
+
+private:
+	static constexpr uint8_t WINDOW = 32;    // 入力を覚えておくステップ数(ビットの数)
+	static_assert(INPUT_DELAY >= 1 && 2 * INPUT_DELAY < WINDOW, "INPUT_DELAY must be 1 to 15.");
+
+	static uint32_t write_bit(uint32_t bits, uint16_t step, bool value) {
+		uint32_t mask = 1UL << (step % WINDOW);
+		return value ? bits | mask : bits & ~mask;
+	}
+
+	static bool read_bit(uint32_t bits, uint16_t step) {
+		return (bits & 1UL << (step % WINDOW)) != 0;
+	}
+
+	uart_port& m_port;
+	uint16_t m_step = 0;    // 次に計算するステップ
+	uint16_t m_remote_next = 0;    // 次に届くはずの相手のステップ
+	uint32_t m_local_bits = 0;    // ステップ % WINDOWのビットが入力
+	uint32_t m_remote_bits = 0;
+	uint16_t m_waiting = 0;
+	uint8_t m_stalls = 0;
+	uint8_t m_min_slack = 0;
+	uint8_t m_control = 0;
+	bool m_has_control = false;
+	bool m_desync = false;
+	bool m_running = false;
+};
+
+#endif
+
+/*
+  対戦のルール。両方の筐体で同じ計算をするので、入力と乱数の種以外のもの(ティック、rand)は使わない
+
+  ボールは打った側(striker)のバーを0からBarLength - 1まで進み、相手のバーに移って
+  BarLength - 1から0に戻ってくる(位置はBarLength～2 * BarLength - 1)。最後のHitWindow個の
+  位置で相手がスイッチを押せば打ち返し、今度は相手が打った側になる。押せずに端を越えたら
+  打った側の得点で、失点した側から次のボールを出す。WIN_POINTS点先取で終わり。
+  スイッチは押した瞬間だけを見る。離してからLOCKOUT_STEPSの間は無効(チャタリング、連打防止)。
+ */
+template <int BarLength, int HitWindow>
+class versus_match
+{
+public:
+	static constexpr uint8_t WIN_POINTS = 5;
+	static constexpr uint8_t LOCKOUT_STEPS = 50;    // 約0.1秒
+	static constexpr uint16_t SERVE_STEPS = 500;    // 得点から次のボールまで(約1秒)
+
+	// stepの結果
+	enum event : uint8_t
+	{
+		HIT = 0x01,    // 打ち返した。打ったのはstriker()
+		POINT = 0x02,    // 得点した。次にボールを出す(失点した)のはstriker()
+		FINISHED = 0x04,    // 終わった。勝ったのはwinner()
+	};
+
+	// 難易度の待ち時間(フレーム)を決める値は、招待した側の難易度のものを使う
+	void start(uint16_t seed, int initial_wait, int score_per_step) {
+		m_random = seed == 0 ? 1 : seed;
+		m_initial_wait = initial_wait;
+		m_score_per_step = score_per_step;
+		m_points[0] = 0;
+		m_points[1] = 0;
+		m_pressed = 0x03;    // スイッチを押して始めるので、一度離すまでは無効
+		m_released_steps[0] = 0;
+		m_released_steps[1] = 0;
+		m_striker = 0;
+		serve();
+	}
+
+	// 1ステップ進める。inputsのビット0がプレイヤー0(招待した側)、ビット1がプレイヤー1のスイッチ
+	uint8_t step(uint8_t inputs) {
+		uint8_t edges = static_cast<uint8_t>(inputs & ~m_pressed);
+		for (uint8_t p = 0; p < 2; ++p) {
+			if (inputs & (1 << p)) {
+				m_released_steps[p] = 0;
+			} else if (m_released_steps[p] < LOCKOUT_STEPS) {
+				++m_released_steps[p];
+			}
+		}
+		m_pressed = inputs;
+		uint8_t receiver = static_cast<uint8_t>(1 - m_striker);
+		// m_armedは前のステップで決めた、押す直前の状態
+		if ((edges & (1 << receiver)) && m_armed[receiver] && m_position >= TRIP - HitWindow) {
+			m_striker = receiver;
+			++m_rally;
+			m_position = 0;
+			m_step_wait = calc_wait();
+			m_wait_steps = m_step_wait;
+			update_armed();
+			return HIT;
+		}
+		update_armed();
+		if (m_wait_steps > 0) {
+			--m_wait_steps;
+			return 0;
+		}
+		m_wait_steps = m_step_wait;
+		if (++m_position < TRIP) return 0;
+		// 打ち返せなかった
+		if (++m_points[m_striker] >= WIN_POINTS) {
+			m_position = -1;
+			m_wait_steps = 0xFFFF;
+			return POINT | FINISHED;
+		}
+		m_striker = receiver;
+		serve();
+		return POINT;
+	}
+
+	// 最後に打った側。得点のあとは次にボールを出す側
+	uint8_t striker() const {
+		return m_striker;
+	}
+
+	uint8_t points(uint8_t player) const {
+		return m_points[player];
+	}
+
+	// playerのバーに出す位置。ボールがplayerの側になければ-1
+	int position_for(uint8_t player) const {
+		if (m_position < 0) return -1;
+		if (m_position < BarLength) return player == m_striker ? m_position : -1;
+		return player != m_striker ? TRIP - 1 - m_position : -1;
+	}
+
+	// 終わったときに勝った側
+	uint8_t winner() const {
+		return m_points[0] >= WIN_POINTS ? 0 : 1;
+	}
+
+private:
+	static constexpr int TRIP = 2 * BarLength;
+
+	// strikerの側の端からボールを出す。SERVE_STEPSの間はボールを出さない
+	void serve() {
+		m_rally = 0;
+		m_position = -1;
+		m_step_wait = calc_wait();
+		m_wait_steps = SERVE_STEPS;
+	}
+
+	void update_armed() {
+		for (uint8_t p = 0; p < 2; ++p) {
+			m_armed[p] = (m_pressed & (1 << p)) == 0 && m_released_steps[p] >= LOCKOUT_STEPS;
+		}
+	}
+
+	// 1歩のフレーム数。打ち返した回数で速くなり、±20%ばらつく
+	uint16_t calc_wait() {
+		int32_t value = static_cast<int32_t>(m_initial_wait - m_rally / m_score_per_step) * (80 + next_random() % 40) / 100;
+		return value <= 0 ? 1 : static_cast<uint16_t>(value);
+	}
+
+	// xorshift16
+	uint16_t next_random() {
+		m_random = static_cast<uint16_t>(m_random ^ m_random << 7);
+		m_random = static_cast<uint16_t>(m_random ^ m_random >> 9);
+		m_random = static_cast<uint16_t>(m_random ^ m_random << 8);
+		return m_random;
+	}
+
+	uint16_t m_random = 1;
+	int m_initial_wait = 0;
+	int m_score_per_step = 1;
+	int m_position = -1;    // ボールの位置。0～TRIP - 1。-1ならボールなし
+	uint16_t m_wait_steps = 0;    // 次に動くまでのステップ数
+	uint16_t m_step_wait = 0;    // 1歩のステップ数
+	int m_rally = 0;    // このボールで打ち返した回数
+	uint8_t m_points[2] {};
+	uint8_t m_striker = 0;
+	uint8_t m_pressed = 0;
+	uint8_t m_released_steps[2] {};
+	bool m_armed[2] {};
+};
+
+#endif
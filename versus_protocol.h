@@ -0,0 +1,85 @@
+#ifndef VERSUS_PROTOCOL_H
+#define VERSUS_PROTOCOL_H
+
+/*
+  対戦モード(VERSUS = 1)で2台の筐体がUARTでやりとりするバイトの形式
+
+  どのバイトも1バイトで完結する。送るのは1フレーム(FAST_TICKでないときの1ティック、約2ms)に
+  1バイトまでなので、9600bpsの約半分しか使わない。
+
+    1sss sssb   入力  s: ステップ番号の下位6ビット、b: ゲームスイッチを押しているか
+    01dd ssss   招待  d: 難易度、s: 乱数の種の下位4ビット
+    001s ssss   受諾  s: 乱数の種の上位5ビット
+    0000 0001   中断  対戦をやめる
+
+  入力はステップ番号の順に届くはずなので、番号が飛んだら同期が崩れたとみなして対戦を中断する。
+ */
+
+#include <stdint.h>
+
+namespace versus_protocol
+{
+	constexpr uint8_t INPUT = 0x80;
+	constexpr uint8_t INVITE = 0x40;
+	constexpr uint8_t ACCEPT = 0x20;
+	constexpr uint8_t ABORT = 0x01;
+
+	constexpr uint8_t STEP_MASK = 0x3F;    // 入力に載せるステップ番号の範囲
+
+	constexpr uint8_t input(uint16_t step, bool pressed)
+	{
+		return static_cast<uint8_t>(INPUT | (step & STEP_MASK) << 1 | (pressed ? 1 : 0));
+	}
+
+	constexpr bool is_input(uint8_t byte)
+	{
+		return (byte & INPUT) != 0;
+	}
+
+	constexpr uint8_t input_step(uint8_t byte)
+	{
+		return static_cast<uint8_t>((byte >> 1) & STEP_MASK);
+	}
+
+	constexpr bool input_pressed(uint8_t byte)
+	{
+		return (byte & 1) != 0;
+	}
+
+	constexpr uint8_t invite(uint8_t difficulty, uint8_t seed)
+	{
+		return static_cast<uint8_t>(INVITE | (difficulty & 0x03) << 4 | (seed & 0x0F));
+	}
+
+	constexpr bool is_invite(uint8_t byte)
+	{
+		return (byte & 0xC0) == INVITE;
+	}
+
+	constexpr uint8_t invite_difficulty(uint8_t byte)
+	{
+		return static_cast<uint8_t>((byte >> 4) & 0x03);
+	}
+
+	constexpr uint8_t invite_seed(uint8_t byte)
+	{
+		return static_cast<uint8_t>(byte & 0x0F);
+	}
+
+	constexpr uint8_t accept(uint8_t seed)
+	{
+		return static_cast<uint8_t>(ACCEPT | (seed & 0x1F));
+	}
+
+	constexpr bool is_accept(uint8_t byte)
+	{
+		return (byte & 0xE0) == ACCEPT;
+	}
+
+	constexpr uint8_t accept_seed(uint8_t byte)
+	{
+		return static_cast<uint8_t>(byte & 0x1F);
+	}
+}
+
+#endif
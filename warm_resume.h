@@ -0,0 +1,114 @@
+#ifndef WARM_RESUME_H
+#define WARM_RESUME_H
+
+/*
+  ウォッチドッグによるリセットからの再開
+
+  ウォッチドッグのリセットではRAMの内容は消えないので、ゲームの状態の写しを.noinitセクション
+  (スタートアップでゼロクリアされない)に置いておく。写しはCRC-8と目印で守る。
+  ウォッチドッグのリセットで、写しが正しければ、各Singletonは写しから値を取り(EEPROMは読まない)、
+  game_managerは最後の状態から再開する。それ以外のリセットでは今までどおりEEPROMから読む。
+
+  状態は関数ポインタではなくgame_stateの値で残す。ポインタが壊れて暴走したときも、
+  再開するときにchange_stateで引き直すので、壊れたポインタを持ち越さない。
+
+  MCUSRはスタートアップの.init3で読んでreset_causeに写し、消す。ウォッチドッグのリセットのあとは
+  ウォッチドッグが最短の周期で動いたままなので、同時に止める(mainで改めて有効にする)。
+  ブートローダはMCUSRを消さずにアプリを起動するので、ブートローダがあっても同じ。
+  ブートローダのスタートアップが写しのあるRAMを消したときは、CRCが合わないので通常の起動になる。
+
+  同じ場所で止まり続ける(再開してもすぐにまたリセットされる)と、再開を繰り返して動かなくなる。
+  再開してからsettled(約1秒ティックが回った)までにリセットされた回数をwarm_resume_countに数え、
+  MAX_RESUMES回を超えたら写しを使わずに通常の起動(EEPROMを読み、ready_to_start)にする。
+  settledまでは、その後のウォッチドッグのリセットも通常の起動にする。
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <util/crc16.h>
+
+// 再開に使う状態の写し
+struct warm_image
+{
+	uint16_t magic;
+	uint8_t state;    // game_state
+	uint8_t score;
+	uint8_t high_score;
+	uint8_t difficulty;
+	uint16_t games;
+	uint16_t hits;
+	uint8_t crc;    // ここより前のCRC-8
+};
+
+// リセット要因(MCUSRの値)と写し。定義と.init3のsave_reset_causeはavr-hokey.cppに置く
+extern uint8_t reset_cause;
+extern warm_image warm_image_ram;
+extern uint8_t warm_resume_count;    // 続けて再開した回数
+
+// 写しの管理。Singleton
+class warm_resume
+{
+public:
+	static warm_resume& instance() {
+		static warm_resume object;
+		return object;
+	}
+
+	// 起動したときに写しが使えたか。各Singletonのコンストラクタで見る
+	bool valid() const {
+		return m_valid;
+	}
+
+	// 再開してから正常に動いている。続けて再開した回数を戻す
+	void settled() {
+		warm_resume_count = 0;
+	}
+
+	const warm_image& image() const {
+		return warm_image_ram;
+	}
+
+	// 写しの1項目を書き換え、CRCを付け直す
+	template <class T>
+	void set(T warm_image::* field, T value) {
+		warm_image_ram.*field = value;
+		seal();
+	}
+
+private:
+	static constexpr uint16_t MAGIC = 0x5742;
+	static constexpr uint8_t MAX_RESUMES = 3;
+
+	warm_resume() {
+		if ((reset_cause & _BV(WDRF)) == 0) {
+			warm_resume_count = 0;    // 電源投入ではゴミが入っている
+		} else if (warm_resume_count <= MAX_RESUMES) {
+			++warm_resume_count;
+		}
+		m_valid = (reset_cause & _BV(WDRF)) != 0 && warm_resume_count <= MAX_RESUMES &&
+			warm_image_ram.magic == MAGIC && warm_image_ram.crc == crc();
+		if (!m_valid) {
+			warm_image_ram = warm_image{};
+			warm_image_ram.magic = MAGIC;
+			seal();
+		}
+	}
+
+	static uint8_t crc() {
+		const uint8_t* p = reinterpret_cast<const uint8_t*>(&warm_image_ram);
+		uint8_t value = 0;
+		for (uint8_t i = 0; i < sizeof(warm_image) - 1; ++i) {
+			value = _crc8_ccitt_update(value, p[i]);
+		}
+		return value;
+	}
+
+	static void seal() {
+		warm_image_ram.crc = crc();
+	}
+
+	bool m_valid;
+};
+
+#endif